@@ -1,10 +1,5 @@
 #pragma once
 
-//
-// Maximum number of CPUs.
-//
-#define HVPP_MAX_CPU  256
-
 //
 // Disable logging (DbgPrintEx) and/or ETW logging.
 //
@@ -13,6 +8,43 @@
 
 // #define HVPP_DISABLE_TRACELOG
 
+//
+// Minimum level of log messages which are compiled in - per module
+// (see logger::module_t).  Messages below this level are removed at
+// compile time.  Levels: trace, debug, info, warn, error.
+//
+// Levels enabled at runtime can be further restricted per module
+// by logger::set_level().
+//
+#define HVPP_LOG_LEVEL_GENERIC  trace
+#define HVPP_LOG_LEVEL_EPT      trace
+#define HVPP_LOG_LEVEL_VCPU     trace
+#define HVPP_LOG_LEVEL_VMEXIT   trace
+#define HVPP_LOG_LEVEL_MM       trace
+
+//
+// Rate limit of the log call sites which use hvpp_*_ratelimited() macros
+// (per call site and per CPU): at most HVPP_LOG_RATELIMIT_BURST messages
+// at once and HVPP_LOG_RATELIMIT_RATE messages per second on average.
+//
+#define HVPP_LOG_RATELIMIT_BURST  10
+#define HVPP_LOG_RATELIMIT_RATE   100
+
+//
+// Uncomment this if you want hvpp_trace() to store raw arguments into
+// per-CPU ring buffers instead of formatting them and sending them via
+// ETW.  Records can be then read (and formatted) by the read request
+// on the device (see logger::trace::read()).
+//
+// #define HVPP_ENABLE_BINARY_TRACE
+
+//
+// Uncomment this if you want to collect contention statistics of the
+// instrumented spinlocks (acquire count, contended count, cycles spent
+// waiting).  See spinlock_stats.h.
+//
+// #define HVPP_ENABLE_SPINLOCK_STATS
+
 //
 // Disable asserts (hvpp_assert()).
 //
@@ -24,3 +56,21 @@
 // in VMWare and you don't want the VMWare Tools to crash.
 //
 #define HVPP_ENABLE_VMWARE_WORKAROUND
+
+//
+// Uncomment this if you want the hypervisor (host) to run with its own
+// copy of the "System" page-tables, which additionally map all physical
+// memory (see mm::direct_map_t).  Guest memory can be then accessed
+// without remapping of the memory_mapper window (and without INVLPG).
+//
+// #define HVPP_ENABLE_HOST_DIRECT_MAP
+
+//
+// Uncomment this if you want to save the full x87/SSE state (FXSAVE)
+// only when it's needed - i.e. when the VM-exit handler calls
+// vcpu_t::fp_state_save() or when it requests eager saving via
+// vcpu_t::fp_state_eager().  Only the SSE registers (XMM0-XMM15
+// and MXCSR) are then saved on each VM-exit.
+// See vcpu_t::entry_host() for more details.
+//
+// #define HVPP_LAZY_FP_STATE
@@ -0,0 +1,243 @@
+#include "cpuid_cache.h"
+
+#include "ia32/asm.h"
+
+#include <cstring>
+
+namespace hvpp {
+
+namespace detail
+{
+  //
+  // Returns true if the result of this leaf depends on the ECX
+  // value (subleaf).  For other leaves the ECX is ignored by the CPU,
+  // therefore it shouldn't be part of the cache key - otherwise
+  // garbage in ECX would pollute the cache.
+  //
+  static bool cpuid_leaf_has_subleaf(uint32_t leaf) noexcept
+  {
+    switch (leaf)
+    {
+      case 0x0000'0000:
+      case 0x0000'0001:
+      case 0x0000'0002:
+      case 0x0000'0003:
+      case 0x0000'0005:
+      case 0x0000'0006:
+      case 0x0000'000a:
+      case 0x8000'0000:
+      case 0x8000'0001:
+      case 0x8000'0002:
+      case 0x8000'0003:
+      case 0x8000'0004:
+      case 0x8000'0005:
+      case 0x8000'0006:
+      case 0x8000'0007:
+      case 0x8000'0008:
+        return false;
+
+      default:
+        return true;
+    }
+  }
+
+  static size_t cpuid_hash(uint32_t leaf, uint32_t subleaf) noexcept
+  {
+    return static_cast<uint32_t>((leaf ^ (leaf >> 16) ^ (subleaf * 0x9e37'79b1u)) * 0x9e37'79b1u) >> (32 - 6);
+  }
+
+  static_assert(cpuid_cache_t::capacity == (1 << 6));
+}
+
+cpuid_cache_t::cpuid_cache_t() noexcept
+  : entry_{}
+  , volatile_leaf_{}
+  , volatile_leaf_count_{}
+  , override_{}
+  , override_count_{}
+  , hit_count_{}
+  , miss_count_{}
+{
+  //
+  // CPUID leaf 0xD (processor extended state enumeration) reports
+  // size of the XSAVE area required by the features enabled in XCR0
+  // (and IA32_XSS).  These can be changed by the guest at any time.
+  // (ref: Vol2A[(CPUID-CPU Identification)])
+  //
+  add_volatile_leaf(0x0000'000d);
+
+  //
+  // CPUID leaf 1 has a side effect: it loads the microcode update
+  // signature into IA32_BIOS_SIGN_ID (MSR 0x8B).  Guests read the
+  // microcode revision by writing 0 to this MSR, executing CPUID(1)
+  // and reading the MSR back - access to the MSR doesn't cause
+  // VM-exit, therefore the CPUID must really be executed.
+  // (ref: Vol3A[9.11.7.1(Determining the Signature)])
+  //
+  add_volatile_leaf(0x0000'0001);
+}
+
+void cpuid_cache_t::cpuid(uint32_t cpu_info[4], uint32_t eax, uint32_t ecx, ia32::cr4_t guest_cr4) noexcept
+{
+  cpuid_cached(cpu_info, eax, ecx);
+
+  //
+  // CPUID.1:ECX[27] (OSXSAVE) is a copy of CR4.OSXSAVE and
+  // CPUID.(7,0):ECX[4] (OSPKE) is a copy of CR4.PKE.
+  // (ref: Vol2A[(CPUID-CPU Identification)])
+  //
+  if (eax == 0x0000'0001)
+  {
+    constexpr auto osxsave_bit = 1u << 27;
+
+    cpu_info[cpuid_ecx] = guest_cr4.os_xsave
+      ? cpu_info[cpuid_ecx] |  osxsave_bit
+      : cpu_info[cpuid_ecx] & ~osxsave_bit;
+  }
+  else if (eax == 0x0000'0007 && ecx == 0)
+  {
+    constexpr auto ospke_bit = 1u << 4;
+
+    cpu_info[cpuid_ecx] = guest_cr4.protection_key_enable
+      ? cpu_info[cpuid_ecx] |  ospke_bit
+      : cpu_info[cpuid_ecx] & ~ospke_bit;
+  }
+}
+
+void cpuid_cache_t::cpuid_cached(uint32_t cpu_info[4], uint32_t eax, uint32_t ecx) noexcept
+{
+  const auto leaf    = eax;
+  const auto subleaf = detail::cpuid_leaf_has_subleaf(leaf) ? ecx : 0;
+
+  if (is_volatile(leaf))
+  {
+    miss_count_ += 1;
+
+    ia32_asm_cpuid_ex(cpu_info, eax, ecx);
+    apply_overrides(cpu_info, leaf, subleaf);
+    return;
+  }
+
+  auto index = detail::cpuid_hash(leaf, subleaf);
+  entry_t* free_entry = nullptr;
+
+  for (size_t probe = 0; probe < max_probe; ++probe)
+  {
+    auto& entry = entry_[index];
+
+    if (!entry.valid)
+    {
+      free_entry = &entry;
+      break;
+    }
+
+    if (entry.leaf == leaf && entry.subleaf == subleaf)
+    {
+      hit_count_ += 1;
+
+      memcpy(cpu_info, entry.cpu_info, sizeof(entry.cpu_info));
+      return;
+    }
+
+    index = (index + 1) % capacity;
+  }
+
+  miss_count_ += 1;
+
+  ia32_asm_cpuid_ex(cpu_info, eax, ecx);
+  apply_overrides(cpu_info, leaf, subleaf);
+
+  //
+  // If there isn't free slot, the result is simply not cached.
+  //
+  if (free_entry)
+  {
+    free_entry->leaf    = leaf;
+    free_entry->subleaf = subleaf;
+    free_entry->valid   = true;
+    memcpy(free_entry->cpu_info, cpu_info, sizeof(free_entry->cpu_info));
+  }
+}
+
+void cpuid_cache_t::flush() noexcept
+{
+  for (auto& entry : entry_)
+  {
+    entry.valid = false;
+  }
+}
+
+auto cpuid_cache_t::add_volatile_leaf(uint32_t leaf) noexcept -> error_code_t
+{
+  if (is_volatile(leaf))
+  {
+    return {};
+  }
+
+  if (volatile_leaf_count_ == volatile_leaf_max)
+  {
+    return make_error_code_t(std::errc::not_enough_memory);
+  }
+
+  volatile_leaf_[volatile_leaf_count_++] = leaf;
+
+  //
+  // The leaf might have been cached already.
+  //
+  flush();
+  return {};
+}
+
+auto cpuid_cache_t::add_override(uint32_t leaf, uint32_t subleaf, cpuid_register reg, uint32_t mask, uint32_t value) noexcept -> error_code_t
+{
+  if (override_count_ == override_max)
+  {
+    return make_error_code_t(std::errc::not_enough_memory);
+  }
+
+  override_[override_count_++] = override_t{ leaf, subleaf, reg, mask, value };
+
+  //
+  // Cached results don't have this override applied.
+  //
+  flush();
+  return {};
+}
+
+auto cpuid_cache_t::hit_count() const noexcept -> uint64_t
+{
+  return hit_count_;
+}
+
+auto cpuid_cache_t::miss_count() const noexcept -> uint64_t
+{
+  return miss_count_;
+}
+
+bool cpuid_cache_t::is_volatile(uint32_t leaf) const noexcept
+{
+  for (size_t i = 0; i < volatile_leaf_count_; ++i)
+  {
+    if (volatile_leaf_[i] == leaf)
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void cpuid_cache_t::apply_overrides(uint32_t cpu_info[4], uint32_t leaf, uint32_t subleaf) const noexcept
+{
+  for (size_t i = 0; i < override_count_; ++i)
+  {
+    const auto& item = override_[i];
+
+    if (item.leaf == leaf && (item.subleaf == subleaf_any || item.subleaf == subleaf))
+    {
+      cpu_info[item.reg] = (cpu_info[item.reg] & ~item.mask) | (item.value & item.mask);
+    }
+  }
+}
+
+}
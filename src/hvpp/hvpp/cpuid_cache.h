@@ -0,0 +1,129 @@
+#pragma once
+#include "ia32/arch/cr.h"
+#include "lib/error.h"
+
+#include <cstdint>
+
+namespace hvpp {
+
+//
+// Per-VCPU cache of CPUID results.
+//
+// CPUID is serializing instruction and it's quite expensive (even
+// more when we're running nested under another hypervisor).  Results
+// of most CPUID leaves never change, therefore they can be cached.
+//
+// Leaves which results do change (e.g. leaf 0xD, which reports sizes
+// of XSAVE area based on the current XCR0) or which execution has
+// side effects (leaf 1, see the constructor) can be registered as
+// "volatile" - CPUID is then always executed for them.
+//
+// Results can be also adjusted by static overrides (e.g. hiding
+// of the "hypervisor present" bit).  Overrides are applied before
+// the result is inserted into the cache, therefore they cost nothing
+// on cache hit.
+//
+// Note that the cache is per-VCPU (and each VCPU runs on its own
+// physical CPU), therefore leaves reporting APIC ID of the current
+// CPU can be cached safely.
+//
+// CPUID.1:ECX[27] (OSXSAVE) and CPUID.(7,0):ECX[4] (OSPKE) reflect
+// CR4.OSXSAVE and CR4.PKE of the CPU which executes the CPUID - in
+// VMX-root mode that's the host CR4.  These bits are therefore always
+// set according to the guest CR4 (passed by the caller) - on cache hit
+// as well.  Overrides of these bits are ignored.
+//
+
+class cpuid_cache_t final
+{
+  public:
+    static constexpr size_t   capacity          = 64;
+    static constexpr size_t   max_probe         = 8;
+    static constexpr size_t   volatile_leaf_max = 16;
+    static constexpr size_t   override_max      = 16;
+
+    //
+    // Value of "subleaf" which matches any subleaf.
+    //
+    static constexpr uint32_t subleaf_any       = ~uint32_t(0);
+
+    enum cpuid_register
+    {
+      cpuid_eax,
+      cpuid_ebx,
+      cpuid_ecx,
+      cpuid_edx,
+    };
+
+    cpuid_cache_t() noexcept;
+    cpuid_cache_t(const cpuid_cache_t& other) noexcept = delete;
+    cpuid_cache_t(cpuid_cache_t&& other) noexcept = delete;
+    ~cpuid_cache_t() noexcept = default;
+
+    cpuid_cache_t& operator=(const cpuid_cache_t& other) noexcept = delete;
+    cpuid_cache_t& operator=(cpuid_cache_t&& other) noexcept = delete;
+
+    //
+    // Same as ia32_asm_cpuid_ex() executed by the guest with "guest_cr4",
+    // but the result may come from the cache.
+    //
+    void cpuid(uint32_t cpu_info[4], uint32_t eax, uint32_t ecx, ia32::cr4_t guest_cr4) noexcept;
+
+    //
+    // Invalidate all cached results.
+    //
+    void flush() noexcept;
+
+    //
+    // Result of this leaf (all subleafs) is never cached.
+    //
+    auto add_volatile_leaf(uint32_t leaf) noexcept -> error_code_t;
+
+    //
+    // Bits in "mask" of the selected register are replaced with
+    // corresponding bits from "value".  Example (hide hypervisor
+    // present bit - CPUID.1:ECX[31]):
+    //
+    //   add_override(1, subleaf_any, cpuid_ecx, 1u << 31, 0);
+    //
+    auto add_override(uint32_t leaf, uint32_t subleaf, cpuid_register reg, uint32_t mask, uint32_t value) noexcept -> error_code_t;
+
+    auto hit_count() const noexcept -> uint64_t;
+    auto miss_count() const noexcept -> uint64_t;
+
+  private:
+    struct entry_t
+    {
+      uint32_t leaf;
+      uint32_t subleaf;
+      uint32_t cpu_info[4];
+      bool     valid;
+    };
+
+    struct override_t
+    {
+      uint32_t       leaf;
+      uint32_t       subleaf;
+      cpuid_register reg;
+      uint32_t       mask;
+      uint32_t       value;
+    };
+
+    void cpuid_cached(uint32_t cpu_info[4], uint32_t eax, uint32_t ecx) noexcept;
+
+    bool is_volatile(uint32_t leaf) const noexcept;
+    void apply_overrides(uint32_t cpu_info[4], uint32_t leaf, uint32_t subleaf) const noexcept;
+
+    entry_t    entry_[capacity];
+
+    uint32_t   volatile_leaf_[volatile_leaf_max];
+    size_t     volatile_leaf_count_;
+
+    override_t override_[override_max];
+    size_t     override_count_;
+
+    uint64_t   hit_count_;
+    uint64_t   miss_count_;
+};
+
+}
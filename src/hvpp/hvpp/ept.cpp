@@ -1,3 +1,5 @@
+#define HVPP_LOG_MODULE ept
+
 #include "ept.h"
 
 #include "lib/assert.h"
@@ -7,6 +7,7 @@
 #include "lib/log.h"
 #include "lib/mm.h"
 #include "lib/mp.h"
+#include "lib/percpu.h"
 
 namespace hvpp::hypervisor
 {
@@ -60,12 +61,38 @@ namespace hvpp::hypervisor
 
   struct global_t
   {
-    vcpu_t* vcpu_list;
-    bool    running;
+    //
+    // VCPU of each CPU (pointer in the per-CPU block).
+    //
+    percpu::slot_t<vcpu_t*> vcpu;
+    bool                    running;
   };
 
   static global_t global;
 
+  namespace detail
+  {
+    static
+    void
+    destroy_vcpus(
+      void
+      ) noexcept
+    {
+      for (uint32_t idx = 0; idx < mp::cpu_count(); ++idx)
+      {
+        auto& vp = global.vcpu.get(idx);
+
+        if (vp)
+        {
+          std::destroy_at(vp);
+          delete static_cast<void*>(vp);
+
+          vp = nullptr;
+        }
+      }
+    }
+  }
+
   auto start(vmexit_handler& handler) noexcept -> error_code_t
   {
     //
@@ -79,29 +106,43 @@ namespace hvpp::hypervisor
     }
 
     //
-    // Create array of VCPUs.
+    // Reserve per-CPU slot for the VCPU pointer.
     //
-    // Note that since:
-    //   - vcpu_t is not default-constructible
-    //   - operator new[] doesn't support constructing objects
-    //     with parameters
-    // ... we have to construct this array "placement new".
-    //
-    hvpp_assert(global.vcpu_list == nullptr);
-
-    global.vcpu_list = reinterpret_cast<vcpu_t*>(operator new(sizeof(vcpu_t) * mp::cpu_count()));
-    if (!global.vcpu_list)
+    if (auto err = global.vcpu.initialize())
     {
-      return make_error_code_t(std::errc::not_enough_memory);
+      return err;
     }
 
     //
-    // Construct each vcpu_t object as `vcpu_t(handler)'.
+    // Create VCPUs.
+    //
+    // Each VCPU is allocated separately (instead of one contiguous
+    // array) and only the pointer to it is stored in the per-CPU
+    // block of its CPU.  VCPUs are created only for active CPUs
+    // (pointers of other CPUs stay nullptr).
+    //
+    // Note that since vcpu_t is not default-constructible and
+    // operator new may return nullptr, each object is constructed
+    // as `vcpu_t(handler)' by "placement new".
     //
-    std::for_each_n(global.vcpu_list, mp::cpu_count(),
-      [&](vcpu_t& vp) {
-        ::new (std::addressof(vp)) vcpu_t(handler);
-      });
+    for (uint32_t idx = 0; idx < mp::cpu_count(); ++idx)
+    {
+      hvpp_assert(global.vcpu.get(idx) == nullptr);
+
+      if (!mp::cpu_is_active(idx))
+      {
+        continue;
+      }
+
+      const auto vp = reinterpret_cast<vcpu_t*>(operator new(sizeof(vcpu_t)));
+      if (!vp)
+      {
+        detail::destroy_vcpus();
+        return make_error_code_t(std::errc::not_enough_memory);
+      }
+
+      global.vcpu.get(idx) = ::new (vp) vcpu_t(handler);
+    }
 
     //
     // Check if hypervisor-allocator has been set.
@@ -138,6 +179,21 @@ namespace hvpp::hypervisor
       return make_error_code_t(std::errc::not_supported);
     }
 
+#ifdef HVPP_ENABLE_HOST_DIRECT_MAP
+    //
+    // Build page-tables with direct map of the physical memory.
+    // Their CR3 is used as HOST_CR3 (see mm::host_cr3()).
+    //
+    // Note:
+    //   This must be done before the VCPUs are started and
+    //   at IRQL where system allocator can be used.
+    //
+    if (mm::direct_map().initialize())
+    {
+      hvpp_info("Direct map initialization failed, using System CR3");
+    }
+#endif
+
     //
     // Start virtualization on all CPUs.
     //
@@ -151,8 +207,13 @@ namespace hvpp::hypervisor
     mp::ipi_call([&start_err]() {
       mm::allocator_guard _;
 
-      const auto idx = mp::cpu_index();
-      const auto err = global.vcpu_list[idx].start();
+      //
+      // The CPU might have become active after VCPUs were created.
+      //
+      const auto vp = global.vcpu.get();
+      const auto err = vp
+        ? vp->start()
+        : make_error_code_t(std::errc::no_such_device);
 
       auto expected = error_code_t{};
       start_err.compare_exchange_strong(expected, err);
@@ -199,17 +260,21 @@ namespace hvpp::hypervisor
     mp::ipi_call([]() {
       mm::allocator_guard _;
 
-      const auto idx = mp::cpu_index();
-      global.vcpu_list[idx].stop();
+      if (const auto vp = global.vcpu.get())
+      {
+        vp->stop();
+      }
     });
 
     //
-    // Destroy array of VCPUs.
+    // Page-tables of the direct map are not used anymore.
     //
-    std::destroy_n(global.vcpu_list, mp::cpu_count());
-    delete static_cast<void*>(global.vcpu_list);
+    mm::direct_map().destroy();
 
-    global.vcpu_list = nullptr;
+    //
+    // Destroy VCPUs.
+    //
+    detail::destroy_vcpus();
 
     //
     // Signalize that hypervisor has stopped.
@@ -221,4 +286,41 @@ namespace hvpp::hypervisor
   {
     return global.running;
   }
+
+  bool request_post_all(const vcpu_t::request_t& request) noexcept
+  {
+    if (!global.running)
+    {
+      return false;
+    }
+
+    bool result = true;
+
+    for (uint32_t idx = 0; idx < mp::cpu_count(); ++idx)
+    {
+      if (const auto vp = global.vcpu.get(idx))
+      {
+        result &= vp->request_post(request);
+      }
+    }
+
+    return result;
+  }
+
+  void kick() noexcept
+  {
+    if (!global.running)
+    {
+      return;
+    }
+
+    //
+    // CPUID causes VM-exit unconditionally - and it's never handled
+    // by the fast path while there are pending requests.
+    //
+    mp::ipi_call([]() {
+      uint32_t cpu_info[4];
+      ia32_asm_cpuid(cpu_info, 0);
+    });
+  }
 }
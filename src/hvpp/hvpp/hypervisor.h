@@ -10,4 +10,29 @@ namespace hvpp::hypervisor
   void stop() noexcept;
 
   bool is_running() noexcept;
+
+  //
+  // Post the request to all VCPUs (see vcpu_t::request_post()).
+  // Can be called from VMX-root mode (e.g. from the VM-exit handler
+  // which has modified shared EPT).  Returns false if the request
+  // couldn't be posted to some VCPU.
+  //
+  bool request_post_all(const vcpu_t::request_t& request) noexcept;
+
+  //
+  // Force VM-exit on all CPUs (by IPI, which executes CPUID), so that
+  // pending requests are processed right away instead of on the next
+  // "natural" VM-exit.  CPUID VM-exits are processed by the slow path
+  // while there are pending requests, even if the CPUID fast exit is
+  // enabled (see vcpu_t::fast_exit_enable()).
+  //
+  // Must be called from VMX non-root mode at IRQL where IPIs can be
+  // sent.  There is no kick from VMX-root mode - requests posted by
+  // a VM-exit handler (e.g. on VMCALL) are processed on the next
+  // VM-exit of each VCPU, which might take arbitrarily long.  If the
+  // caller needs them to be processed before it continues, the guest
+  // code which has issued the VMCALL must kick all CPUs afterwards
+  // (call kick() or execute CPUID on each CPU - see hvppctrl).
+  //
+  void kick() noexcept;
 }
@@ -68,6 +68,39 @@ struct fxsave_area_t
 
 static_assert(sizeof(fxsave_area_t) == 512);
 
+//
+// SSE registers used by the compiler-generated code - XMM0-XMM15
+// and MXCSR.
+//
+struct alignas(16) xmm_area_t
+{
+  m128_t   xmm_register[16];  // xmm0-xmm15
+  uint32_t mxcsr;
+  uint32_t reserved[3];
+};
+
+static_assert(sizeof(xmm_area_t) == 272);
+
+//
+// State-components of the XSAVE feature set (bits of XCR0/IA32_XSS).
+// (ref: Vol1[13.1(XSAVE-Supported Features and State-Component Bitmaps)])
+//
+namespace xsave_component
+{
+  static constexpr uint64_t x87         = 1ull << 0;
+  static constexpr uint64_t sse         = 1ull << 1;
+  static constexpr uint64_t avx         = 1ull << 2;
+  static constexpr uint64_t bndregs     = 1ull << 3;
+  static constexpr uint64_t bndcsr      = 1ull << 4;
+  static constexpr uint64_t opmask      = 1ull << 5;
+  static constexpr uint64_t zmm_hi256   = 1ull << 6;
+  static constexpr uint64_t hi16_zmm    = 1ull << 7;
+  static constexpr uint64_t pkru        = 1ull << 9;
+
+  static constexpr uint64_t legacy      = x87 | sse;
+  static constexpr uint64_t avx512      = opmask | zmm_hi256 | hi16_zmm;
+}
+
 struct ymmh_area_t
 {
   m128_t ymmh_register[16];
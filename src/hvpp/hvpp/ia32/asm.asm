@@ -155,6 +155,55 @@ INCLUDE ksamd64.inc
         ret
     ia32_asm_write_msw ENDP
 
+    ;
+    ; Float state save/restore.
+    ;
+    ; Save/restore SSE registers (XMM0-XMM15) and MXCSR.
+    ; RCX = pointer to 16-byte aligned xmm_area_t.
+    ;
+
+    ia32_asm_xmm_save PROC
+        movaps  xmmword ptr [rcx],        xmm0
+        movaps  xmmword ptr [rcx +  10h], xmm1
+        movaps  xmmword ptr [rcx +  20h], xmm2
+        movaps  xmmword ptr [rcx +  30h], xmm3
+        movaps  xmmword ptr [rcx +  40h], xmm4
+        movaps  xmmword ptr [rcx +  50h], xmm5
+        movaps  xmmword ptr [rcx +  60h], xmm6
+        movaps  xmmword ptr [rcx +  70h], xmm7
+        movaps  xmmword ptr [rcx +  80h], xmm8
+        movaps  xmmword ptr [rcx +  90h], xmm9
+        movaps  xmmword ptr [rcx + 0A0h], xmm10
+        movaps  xmmword ptr [rcx + 0B0h], xmm11
+        movaps  xmmword ptr [rcx + 0C0h], xmm12
+        movaps  xmmword ptr [rcx + 0D0h], xmm13
+        movaps  xmmword ptr [rcx + 0E0h], xmm14
+        movaps  xmmword ptr [rcx + 0F0h], xmm15
+        stmxcsr dword ptr [rcx + 100h]
+        ret
+    ia32_asm_xmm_save ENDP
+
+    ia32_asm_xmm_restore PROC
+        ldmxcsr dword ptr [rcx + 100h]
+        movaps  xmm0,  xmmword ptr [rcx]
+        movaps  xmm1,  xmmword ptr [rcx +  10h]
+        movaps  xmm2,  xmmword ptr [rcx +  20h]
+        movaps  xmm3,  xmmword ptr [rcx +  30h]
+        movaps  xmm4,  xmmword ptr [rcx +  40h]
+        movaps  xmm5,  xmmword ptr [rcx +  50h]
+        movaps  xmm6,  xmmword ptr [rcx +  60h]
+        movaps  xmm7,  xmmword ptr [rcx +  70h]
+        movaps  xmm8,  xmmword ptr [rcx +  80h]
+        movaps  xmm9,  xmmword ptr [rcx +  90h]
+        movaps  xmm10, xmmword ptr [rcx + 0A0h]
+        movaps  xmm11, xmmword ptr [rcx + 0B0h]
+        movaps  xmm12, xmmword ptr [rcx + 0C0h]
+        movaps  xmm13, xmmword ptr [rcx + 0D0h]
+        movaps  xmm14, xmmword ptr [rcx + 0E0h]
+        movaps  xmm15, xmmword ptr [rcx + 0F0h]
+        ret
+    ia32_asm_xmm_restore ENDP
+
     ;
     ; Cache control
     ;
@@ -68,6 +68,37 @@ inline void ia32_asm_fx_restore(const void* fxarea) noexcept
   _fxrstor(fxarea);
 }
 
+void ia32_asm_xmm_save(void* xmmarea) noexcept;
+void ia32_asm_xmm_restore(const void* xmmarea) noexcept;
+
+void _xsave64(void*, unsigned __int64);
+#pragma intrinsic(_xsave64)
+inline void ia32_asm_xsave(void* xsarea, uint64_t mask) noexcept
+{
+  _xsave64(xsarea, mask);
+}
+
+void _xsaveopt64(void*, unsigned __int64);
+#pragma intrinsic(_xsaveopt64)
+inline void ia32_asm_xsave_opt(void* xsarea, uint64_t mask) noexcept
+{
+  _xsaveopt64(xsarea, mask);
+}
+
+void _xsavec64(void*, unsigned __int64);
+#pragma intrinsic(_xsavec64)
+inline void ia32_asm_xsave_c(void* xsarea, uint64_t mask) noexcept
+{
+  _xsavec64(xsarea, mask);
+}
+
+void _xrstor64(void const*, unsigned __int64);
+#pragma intrinsic(_xrstor64)
+inline void ia32_asm_xrstor(const void* xsarea, uint64_t mask) noexcept
+{
+  _xrstor64(xsarea, mask);
+}
+
 //
 // Pause/halt.
 //
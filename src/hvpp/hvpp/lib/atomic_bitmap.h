@@ -0,0 +1,85 @@
+#pragma once
+#include <cstdint>
+#include <atomic>
+
+//
+// Fixed-size bitmap with atomic access to individual bits.
+//
+// Unlike bitmap<>, all operations are safe to be called
+// concurrently from multiple CPUs.  All operations use relaxed
+// memory order - the bitmap is meant for flags, not for
+// synchronization of other data.
+//
+
+template <
+  size_t SIZE_IN_BITS
+>
+class atomic_bitmap
+{
+  public:
+    static constexpr size_t size_in_bits = SIZE_IN_BITS;
+
+    atomic_bitmap() noexcept : buffer_{} { }
+    atomic_bitmap(const atomic_bitmap& other) noexcept = delete;
+    atomic_bitmap(atomic_bitmap&& other) noexcept = delete;
+    atomic_bitmap& operator=(const atomic_bitmap& other) noexcept = delete;
+    atomic_bitmap& operator=(atomic_bitmap&& other) noexcept = delete;
+
+    ~atomic_bitmap() noexcept = default;
+
+    void set(size_t bit = 0) noexcept
+    { buffer_[word(bit)].fetch_or(mask(bit), std::memory_order_relaxed); }
+
+    void clear(size_t bit = 0) noexcept
+    { buffer_[word(bit)].fetch_and(~mask(bit), std::memory_order_relaxed); }
+
+    bool test(size_t bit = 0) const noexcept
+    { return !!(buffer_[word(bit)].load(std::memory_order_relaxed) & mask(bit)); }
+
+    //
+    // Atomically clear the bit and return its previous value.
+    //
+    // The bit is tested first by plain load - the (expensive)
+    // interlocked operation is issued only if the bit is set.
+    // This makes the common case (bit is clear) cheap and it
+    // doesn't cause cache line bouncing between CPUs.
+    //
+    bool test_and_clear(size_t bit = 0) noexcept
+    {
+      auto& w = buffer_[word(bit)];
+
+      if (!(w.load(std::memory_order_relaxed) & mask(bit)))
+      {
+        return false;
+      }
+
+      return !!(w.fetch_and(~mask(bit), std::memory_order_relaxed) & mask(bit));
+    }
+
+    void set_all() noexcept
+    {
+      for (auto& w : buffer_)
+      {
+        w.store(~word_t(0), std::memory_order_relaxed);
+      }
+    }
+
+    void clear_all() noexcept
+    {
+      for (auto& w : buffer_)
+      {
+        w.store(word_t(0), std::memory_order_relaxed);
+      }
+    }
+
+  private:
+    using word_t = uint64_t;
+    static constexpr size_t bit_count  = sizeof(word_t) * 8;
+    static constexpr size_t word_count = (SIZE_IN_BITS + bit_count - 1) / bit_count;
+
+    static constexpr size_t offset(size_t bit) noexcept { return bit % bit_count; }
+    static constexpr size_t word  (size_t bit) noexcept { return bit / bit_count; }
+    static constexpr word_t mask  (size_t bit) noexcept { return word_t(1) << offset(bit); }
+
+    std::atomic<word_t> buffer_[word_count];
+};
@@ -32,6 +32,14 @@ class device
     virtual auto on_create() noexcept -> error_code_t
     { return {}; }
 
+    //
+    // Called in the context of the process which closed the last
+    // handle to the file object (unlike on_close(), which may be
+    // called in an arbitrary context).
+    //
+    virtual auto on_cleanup() noexcept -> error_code_t
+    { return {}; }
+
     virtual auto on_close() noexcept -> error_code_t
     { return {}; }
 
@@ -4,6 +4,7 @@
 #include "mm.h"
 #include "mp.h"
 #include "object.h"
+#include "percpu.h"
 #include "log.h"
 
 #include <cinttypes>
@@ -37,13 +38,18 @@ namespace driver::common
     driver_destroy_ = driver_destroy;
 
     //
-    // Initialize logger and memory manager.
+    // Initialize logger, per-CPU data and memory manager.
     //
     if (auto err = logger::initialize())
     {
       return err;
     }
 
+    if (auto err = percpu::initialize())
+    {
+      return err;
+    }
+
     if (auto err = mm::initialize())
     {
       return err;
@@ -125,9 +131,15 @@ namespace driver::common
     }
 
     //
-    // At last, destroy default system allocator.
+    // Destroy default system allocator.
     //
     system_allocator_default_destroy();
+
+    //
+    // At last, destroy per-CPU data (current allocator of each CPU
+    // is stored there).
+    //
+    percpu::destroy();
   }
 
   auto system_allocator_default_initialize() noexcept -> error_code_t
@@ -162,7 +174,7 @@ namespace driver::common
 
     hypervisor_allocator_capacity_ = hypervisor_allocator_recommended_capacity();
 
-    hvpp_info("Number of processors: %u", mp::cpu_count());
+    hvpp_info("Number of processors: %u (maximum: %u)", mp::cpu_active_count(), mp::cpu_count());
     hvpp_info("Reserved memory:      %" PRIu64 " MB",
               hypervisor_allocator_capacity_ / 1024 / 1024);
 
@@ -263,7 +275,7 @@ namespace driver::common
       // Additional 32MB per CPU.
       //
       (32ull * 1024 * 1024)
-      ) * mp::cpu_count();
+      ) * mp::cpu_active_count();
 
     //
     // Round up to page boundary.
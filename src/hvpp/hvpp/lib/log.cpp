@@ -2,6 +2,7 @@
 
 #include <cstdarg>
 #include <cstdio>
+#include <iterator> // std::size()
 
 //
 // Simple logger implementation.
@@ -20,17 +21,60 @@
 // can be called at VERY HIGH frequency (more than 10000 per sec.) and
 // on Windows they can be called from any IRQL.
 //
+// If HVPP_ENABLE_BINARY_TRACE is defined, trace logs aren't formatted
+// at all - they're stored into per-CPU ring buffers instead and formatted
+// later by the consumer (see trace.h).
+//
 
 namespace logger
 {
   level_t   current_level   = level_t::default_flags;
   options_t current_options = options_t::default_flags;
 
+  level_t   current_module_level[] = {
+    level_t::default_flags,   // generic
+    level_t::default_flags,   // ept
+    level_t::default_flags,   // vcpu
+    level_t::default_flags,   // vmexit
+    level_t::default_flags,   // mm
+  };
+
+  static_assert(std::size(current_module_level) == static_cast<size_t>(module_t::count));
+
   auto initialize() noexcept -> error_code_t
-  { return detail::initialize(); }
+  {
+    if (auto err = detail::initialize())
+    {
+      return err;
+    }
+
+    if (auto err = ratelimit::initialize())
+    {
+      detail::destroy();
+      return err;
+    }
+
+#ifdef HVPP_ENABLE_BINARY_TRACE
+    if (auto err = trace::initialize())
+    {
+      ratelimit::destroy();
+      detail::destroy();
+      return err;
+    }
+#endif
+
+    return {};
+  }
 
   void destroy() noexcept
-  { detail::destroy(); }
+  {
+#ifdef HVPP_ENABLE_BINARY_TRACE
+    trace::destroy();
+#endif
+
+    ratelimit::destroy();
+    detail::destroy();
+  }
 
   void set_options(options_t options) noexcept
   { current_options = options; }
@@ -50,6 +94,15 @@ namespace logger
   bool test_level(level_t level) noexcept
   { return (current_level & level) == level; }
 
+  auto get_level(module_t module) noexcept -> level_t
+  { return current_module_level[static_cast<size_t>(module)]; }
+
+  void set_level(module_t module, level_t level) noexcept
+  { current_module_level[static_cast<size_t>(module)] = level; }
+
+  bool test_level(module_t module, level_t level) noexcept
+  { return test_level(level) && (get_level(module) & level) == level; }
+
   void print(level_t level, const char* function, const char* format, ...) noexcept
   {
     va_list args;
@@ -1,14 +1,77 @@
 #pragma once
 #include "enum.h"
 #include "error.h"
+#include "log_format.h"
+#include "log_ratelimit.h"
+#include "trace.h"
 #include "../config.h"
 
 #include <cstdint>
 
+//
+// Module of the translation unit.  Translation units which want to have
+// their own log levels define HVPP_LOG_MODULE (as one of logger::module_t
+// values, e.g. "vcpu") before including any header.
+//
+#ifndef HVPP_LOG_MODULE
+# define HVPP_LOG_MODULE generic
+#endif
+
+//
+// Format string of each call site is checked against types of its
+// arguments at compile time (see log_format.h).
+//
+// Messages below the compile-time minimum level of the module (see
+// HVPP_LOG_LEVEL_* in config.h) are discarded by "if constexpr" - no
+// code is generated for them and their arguments aren't evaluated.
+// Otherwise the runtime level of the module is tested before the
+// arguments are passed to the logger.
+//
+#define hvpp_log_check_(fmt, ...)                                                     \
+  static_assert(::logger::format::check(fmt,                                          \
+                  decltype(::logger::format::type_list_of(__VA_ARGS__)){}),           \
+                "Format string doesn't match types of the arguments")
+
+#define hvpp_log_(level, fmt, ...)                                                    \
+  do                                                                                  \
+  {                                                                                   \
+    hvpp_log_check_(fmt, __VA_ARGS__);                                                \
+    if constexpr (::logger::is_compiled(::logger::module_t::HVPP_LOG_MODULE, level))  \
+    {                                                                                 \
+      if (::logger::test_level(::logger::module_t::HVPP_LOG_MODULE, level))           \
+      {                                                                               \
+        ::logger::print(level, __FUNCTION__, fmt, __VA_ARGS__);                       \
+      }                                                                               \
+    }                                                                                 \
+  } while (0)
+
+//
+// Register the format string in the format-string section and store
+// only the format ID and raw arguments (see trace.h).
+//
+#define hvpp_log_binary_(level, fmt, ...)                                             \
+  do                                                                                  \
+  {                                                                                   \
+    using hvpp_log_types_ = decltype(::logger::format::type_list_of(__VA_ARGS__));    \
+    hvpp_log_check_(fmt, __VA_ARGS__);                                                \
+    if constexpr (::logger::is_compiled(::logger::module_t::HVPP_LOG_MODULE, level))  \
+    {                                                                                 \
+      HVPP_FORMAT_SECTION_ENTRY static const ::logger::format::entry_t hvpp_log_entry_ =\
+        ::logger::format::make_entry(static_cast<uint32_t>(level), __FUNCTION__,      \
+                                     fmt, hvpp_log_types_{});                         \
+      if (::logger::test_level(::logger::module_t::HVPP_LOG_MODULE, level))           \
+      {                                                                               \
+        ::logger::trace::write(&hvpp_log_entry_, __VA_ARGS__);                        \
+      }                                                                               \
+    }                                                                                 \
+  } while (0)
+
 #if defined(HVPP_DISABLE_TRACELOG)
 # define hvpp_trace(format, ...)
+#elif defined(HVPP_ENABLE_BINARY_TRACE)
+# define hvpp_trace(format, ...)  hvpp_log_binary_(::logger::level_t::trace, format, __VA_ARGS__)
 #else
-# define hvpp_trace(format, ...)  ::logger::print(::logger::level_t::trace, __FUNCTION__, format, __VA_ARGS__)
+# define hvpp_trace(format, ...)  hvpp_log_(::logger::level_t::trace, format, __VA_ARGS__)
 #endif
 
 #if defined(HVPP_DISABLE_LOG)
@@ -17,10 +80,51 @@
 # define hvpp_warn(format, ...)
 # define hvpp_error(format, ...)
 #else
-# define hvpp_debug(format, ...)  ::logger::print(::logger::level_t::debug, __FUNCTION__, format, __VA_ARGS__)
-# define hvpp_info(format, ...)   ::logger::print(::logger::level_t::info,  __FUNCTION__, format, __VA_ARGS__)
-# define hvpp_warn(format, ...)   ::logger::print(::logger::level_t::warn,  __FUNCTION__, format, __VA_ARGS__)
-# define hvpp_error(format, ...)  ::logger::print(::logger::level_t::error, __FUNCTION__, format, __VA_ARGS__)
+# define hvpp_debug(format, ...)  hvpp_log_(::logger::level_t::debug, format, __VA_ARGS__)
+# define hvpp_info(format, ...)   hvpp_log_(::logger::level_t::info,  format, __VA_ARGS__)
+# define hvpp_warn(format, ...)   hvpp_log_(::logger::level_t::warn,  format, __VA_ARGS__)
+# define hvpp_error(format, ...)  hvpp_log_(::logger::level_t::error, format, __VA_ARGS__)
+#endif
+
+//
+// Rate-limited variants (see log_ratelimit.h).  Address of the static
+// (writable, therefore never folded by the linker) variable identifies
+// the call site.
+//
+#define hvpp_log_ratelimited_(level, log, fmt, ...)                                   \
+  do                                                                                  \
+  {                                                                                   \
+    if constexpr (::logger::is_compiled(::logger::module_t::HVPP_LOG_MODULE, level))  \
+    {                                                                                 \
+      static char hvpp_log_site_;                                                     \
+      uint32_t hvpp_log_suppressed_;                                                  \
+      if (::logger::ratelimit::test(&hvpp_log_site_, hvpp_log_suppressed_))           \
+      {                                                                               \
+        if (hvpp_log_suppressed_)                                                     \
+        {                                                                             \
+          log("previous message repeated %u times", hvpp_log_suppressed_);            \
+        }                                                                             \
+        log(fmt, __VA_ARGS__);                                                        \
+      }                                                                               \
+    }                                                                                 \
+  } while (0)
+
+#if defined(HVPP_DISABLE_TRACELOG)
+# define hvpp_trace_ratelimited(format, ...)
+#else
+# define hvpp_trace_ratelimited(format, ...)  hvpp_log_ratelimited_(::logger::level_t::trace, hvpp_trace, format, __VA_ARGS__)
+#endif
+
+#if defined(HVPP_DISABLE_LOG)
+# define hvpp_debug_ratelimited(format, ...)
+# define hvpp_info_ratelimited(format, ...)
+# define hvpp_warn_ratelimited(format, ...)
+# define hvpp_error_ratelimited(format, ...)
+#else
+# define hvpp_debug_ratelimited(format, ...)  hvpp_log_ratelimited_(::logger::level_t::debug, hvpp_debug, format, __VA_ARGS__)
+# define hvpp_info_ratelimited(format, ...)   hvpp_log_ratelimited_(::logger::level_t::info,  hvpp_info,  format, __VA_ARGS__)
+# define hvpp_warn_ratelimited(format, ...)   hvpp_log_ratelimited_(::logger::level_t::warn,  hvpp_warn,  format, __VA_ARGS__)
+# define hvpp_error_ratelimited(format, ...)  hvpp_log_ratelimited_(::logger::level_t::error, hvpp_error, format, __VA_ARGS__)
 #endif
 
 namespace logger
@@ -49,9 +153,38 @@ namespace logger
     default_flags = print_time | print_processor_number /*| print_function_name*/,
   };
 
+  enum class module_t : uint32_t
+  {
+    generic,
+    ept,
+    vcpu,
+    vmexit,
+    mm,
+
+    count
+  };
+
   hvpp_enum_operators(level_t);
   hvpp_enum_operators(options_t);
 
+  //
+  // Compile-time minimum level of the module (see config.h).
+  //
+  constexpr level_t min_level(module_t module) noexcept
+  {
+    switch (module)
+    {
+      case module_t::ept:    return level_t::HVPP_LOG_LEVEL_EPT;
+      case module_t::vcpu:   return level_t::HVPP_LOG_LEVEL_VCPU;
+      case module_t::vmexit: return level_t::HVPP_LOG_LEVEL_VMEXIT;
+      case module_t::mm:     return level_t::HVPP_LOG_LEVEL_MM;
+      default:               return level_t::HVPP_LOG_LEVEL_GENERIC;
+    }
+  }
+
+  constexpr bool is_compiled(module_t module, level_t level) noexcept
+  { return static_cast<uint32_t>(level) >= static_cast<uint32_t>(min_level(module)); }
+
   namespace detail
   {
     auto initialize() noexcept -> error_code_t;
@@ -59,6 +192,18 @@ namespace logger
 
     void vprint(level_t level, const char* function, const char* format, va_list args) noexcept;
     void vprint_trace(level_t level, const char* function, const char* format, va_list args) noexcept;
+
+    //
+    // Non-paged memory for the logger state (the logger is initialized
+    // before the memory manager).
+    //
+    void* allocate(size_t size) noexcept;
+    void  free(void* address) noexcept;
+
+    //
+    // Approximate TSC frequency (ticks per second).
+    //
+    auto  tsc_frequency() noexcept -> uint64_t;
   }
 
   auto initialize() noexcept -> error_code_t;
@@ -72,5 +217,13 @@ namespace logger
   void set_level(level_t level) noexcept;
   bool test_level(level_t level) noexcept;
 
+  //
+  // Runtime levels of the modules.  Message is printed only if its
+  // level is enabled both globally and for its module.
+  //
+  auto get_level(module_t module) noexcept -> level_t;
+  void set_level(module_t module, level_t level) noexcept;
+  bool test_level(module_t module, level_t level) noexcept;
+
   void print(level_t level, const char* function, const char* format, ...) noexcept;
 }
@@ -0,0 +1,340 @@
+#pragma once
+#include "typelist.h"
+
+#include <cstdint>
+#include <type_traits>
+
+//
+// Compile-time format-string registry.
+//
+// Each call site of the logging macro (see log.h) checks at compile
+// time that its format string matches types of the arguments (e.g.
+// "%s" must be given "const char*", "%u" must be given an integer...).
+//
+// Call sites which serialize the raw arguments (binary trace) also
+// place a format_entry_t into the ".hvppfmt" section of the image.
+// Index of the entry in the section is the "format ID" - it's stable
+// for the given image file, therefore the records can be decoded
+// offline, without any help from the driver, just from the image file
+// (see hvppctrl/lib/trace_decoder.cpp).
+//
+// Entries are placed into the "$m" group, the section begins with
+// an empty entry in the "$a" group (format ID 0 is therefore never
+// used).  The linker sorts the groups alphabetically and merges them
+// into single ".hvppfmt" section.
+//
+// The format ID is computed as "entry - begin", which is valid only
+// if the linker doesn't pad contributions of the .obj files by other
+// than whole entries.  Contributions are aligned to the alignment of
+// their contents - therefore entry_t is aligned to its own size.
+// Any padding then consists of whole zero-filled entries, which
+// the decoder rejects (their "format" is null).
+//
+// This header has no dependencies (other than the standard library),
+// so that it can be included by user-mode clients as well.
+//
+
+#pragma section(".hvppfmt$a", read)
+#pragma section(".hvppfmt$m", read)
+#pragma section(".hvppfmt$z", read)
+
+#define HVPP_FORMAT_SECTION_NAME  ".hvppfmt"
+#define HVPP_FORMAT_SECTION_BEGIN __declspec(allocate(".hvppfmt$a"))
+#define HVPP_FORMAT_SECTION_ENTRY __declspec(allocate(".hvppfmt$m"))
+
+namespace logger::format
+{
+  static constexpr uint32_t max_arg_count = 8;
+
+  enum class arg_type_t : uint8_t
+  {
+    none,
+    integer,
+    floating_point,
+    pointer,
+    string,           // Pointer to the null-terminated (narrow) string.
+  };
+
+  struct alignas(32) entry_t
+  {
+    const char* format;
+    const char* function;
+    uint32_t    level;
+    uint32_t    arg_count;
+    arg_type_t  arg_type[max_arg_count];
+  };
+
+  static_assert(sizeof(entry_t) == 32);
+  static_assert(alignof(entry_t) == sizeof(entry_t),
+                "Format ID relies on entries being aligned to their size");
+
+  //
+  // Layout of the serialized (raw) trace records.
+  //
+  // The buffer begins with raw_header_t, which is followed by
+  // "record_count" variable-sized records: raw_record_t followed
+  // by "arg_count" 64-bit arguments.
+  //
+
+  struct raw_header_t
+  {
+    uint64_t image_base;    // Runtime base of the image (for "%s" arguments).
+    uint32_t size;          // Size of valid data (including this header).
+    uint32_t record_count;
+  };
+
+  struct raw_record_t
+  {
+    uint32_t format_id;
+    uint16_t cpu_index;
+    uint16_t arg_count;
+    uint64_t tsc;
+  };
+
+  static_assert(sizeof(raw_header_t) == 16);
+  static_assert(sizeof(raw_record_t) == 16);
+
+  namespace detail
+  {
+    struct signature_t
+    {
+      bool       valid;
+      uint32_t   arg_count;
+      arg_type_t arg_type[max_arg_count];
+    };
+
+    template <typename T>
+    constexpr arg_type_t arg_type_of() noexcept
+    {
+      using type = std::decay_t<T>;
+
+      if constexpr (std::is_pointer_v<type> &&
+                    std::is_same_v<std::remove_cv_t<std::remove_pointer_t<type>>, char>)
+      {
+        return arg_type_t::string;
+      }
+      else if constexpr (std::is_pointer_v<type> || std::is_null_pointer_v<type>)
+      {
+        return arg_type_t::pointer;
+      }
+      else if constexpr (std::is_floating_point_v<type>)
+      {
+        return arg_type_t::floating_point;
+      }
+      else if constexpr (std::is_integral_v<type> || std::is_enum_v<type>)
+      {
+        return arg_type_t::integer;
+      }
+      else
+      {
+        return arg_type_t::none;
+      }
+    }
+
+    constexpr bool is_digit(char c) noexcept
+    { return c >= '0' && c <= '9'; }
+
+    constexpr bool push(signature_t& signature, arg_type_t arg_type) noexcept
+    {
+      if (signature.arg_count == max_arg_count)
+      {
+        signature.valid = false;
+        return false;
+      }
+
+      signature.arg_type[signature.arg_count++] = arg_type;
+      return true;
+    }
+
+    //
+    // Parse the printf-like format string (including MSVC/kernel
+    // extensions, such as "%I64x", "%ws" or "%wZ") and return types
+    // of the arguments it expects.
+    //
+    constexpr signature_t parse(const char* format) noexcept
+    {
+      signature_t signature{};
+      signature.valid = true;
+
+      for (const char* p = format; *p; ++p)
+      {
+        if (*p != '%')
+        {
+          continue;
+        }
+
+        if (*++p == '%')
+        {
+          continue;
+        }
+
+        //
+        // Flags.
+        //
+        while (*p == '-' || *p == '+' || *p == ' ' || *p == '#' || *p == '0')
+        {
+          ++p;
+        }
+
+        //
+        // Width and precision.
+        //
+        if (*p == '*')
+        {
+          if (!push(signature, arg_type_t::integer)) { return signature; }
+          ++p;
+        }
+
+        while (is_digit(*p))
+        {
+          ++p;
+        }
+
+        if (*p == '.')
+        {
+          ++p;
+
+          if (*p == '*')
+          {
+            if (!push(signature, arg_type_t::integer)) { return signature; }
+            ++p;
+          }
+
+          while (is_digit(*p))
+          {
+            ++p;
+          }
+        }
+
+        //
+        // Length modifiers.
+        //
+        bool wide = false;
+
+        for (;;)
+        {
+          if (*p == 'l' || *p == 'w')
+          {
+            wide = true;
+            ++p;
+          }
+          else if (*p == 'h' || *p == 'L' || *p == 'j' || *p == 'z' || *p == 't')
+          {
+            ++p;
+          }
+          else if (*p == 'I')
+          {
+            ++p;
+
+            if ((p[0] == '3' && p[1] == '2') ||
+                (p[0] == '6' && p[1] == '4'))
+            {
+              p += 2;
+            }
+          }
+          else
+          {
+            break;
+          }
+        }
+
+        //
+        // Conversion specifier.
+        //
+        arg_type_t arg_type = arg_type_t::none;
+
+        switch (*p)
+        {
+          case 'c': case 'C':
+          case 'd': case 'i': case 'u':
+          case 'o': case 'x': case 'X':
+            arg_type = arg_type_t::integer;
+            break;
+
+          case 'a': case 'A':
+          case 'e': case 'E':
+          case 'f': case 'F':
+          case 'g': case 'G':
+            arg_type = arg_type_t::floating_point;
+            break;
+
+          case 'p':
+          case 'S':
+          case 'Z':
+            arg_type = arg_type_t::pointer;
+            break;
+
+          case 's':
+            arg_type = wide
+              ? arg_type_t::pointer
+              : arg_type_t::string;
+            break;
+
+          default:
+            //
+            // Unknown conversion specifier (or '%' at the end
+            // of the string).
+            //
+            signature.valid = false;
+            return signature;
+        }
+
+        if (!push(signature, arg_type))
+        {
+          return signature;
+        }
+      }
+
+      return signature;
+    }
+
+    constexpr bool is_compatible(arg_type_t expected, arg_type_t actual) noexcept
+    {
+      //
+      // "%p" accepts any pointer and also integers (addresses are often
+      // held in uint64_t).
+      //
+      return expected == actual
+          || (expected == arg_type_t::pointer && (actual == arg_type_t::string ||
+                                                  actual == arg_type_t::integer));
+    }
+  }
+
+  //
+  // Return type_list of (decayed) types of the arguments.
+  // Used only in unevaluated context.
+  //
+  template <typename ...TArgs>
+  auto type_list_of(const TArgs&...) noexcept -> type_list<std::decay_t<TArgs>...>;
+
+  template <typename ...TArgs>
+  constexpr bool check(const char* format, type_list<TArgs...>) noexcept
+  {
+    const auto signature = detail::parse(format);
+
+    if (!signature.valid || signature.arg_count != sizeof...(TArgs))
+    {
+      return false;
+    }
+
+    const arg_type_t arg_type[] = { detail::arg_type_of<TArgs>()..., arg_type_t::none };
+
+    for (uint32_t i = 0; i < signature.arg_count; ++i)
+    {
+      if (!detail::is_compatible(signature.arg_type[i], arg_type[i]))
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+  template <typename ...TArgs>
+  constexpr entry_t make_entry(uint32_t level, const char* function, const char* format, type_list<TArgs...>) noexcept
+  {
+    static_assert(sizeof...(TArgs) <= max_arg_count, "Too many arguments");
+
+    return entry_t{ format, function, level, uint32_t(sizeof...(TArgs)), { detail::arg_type_of<TArgs>()... } };
+  }
+}
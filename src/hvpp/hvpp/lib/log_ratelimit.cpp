@@ -0,0 +1,133 @@
+#include "log_ratelimit.h"
+
+#include "log.h"
+#include "mp.h"
+
+#include "hvpp/ia32/asm.h"
+#include "hvpp/config.h"
+
+#include <cstring>
+
+namespace logger::ratelimit
+{
+  namespace
+  {
+    struct slot_t
+    {
+      const void* site;
+      uint64_t    last_tsc;
+      uint32_t    tokens;
+      uint32_t    suppressed;
+    };
+
+    struct alignas(64) table_t
+    {
+      slot_t slot[slot_count];
+    };
+
+    static_assert((slot_count & (slot_count - 1)) == 0);
+
+    table_t* table_list_;
+    uint32_t table_count_;
+    uint64_t tsc_per_token_;
+
+    auto slot_index(const void* site) noexcept -> size_t
+    {
+      //
+      // Fibonacci hashing.
+      //
+      return static_cast<size_t>((reinterpret_cast<uint64_t>(site) * 0x9e37'79b9'7f4a'7c15) >> 32) & (slot_count - 1);
+    }
+  }
+
+  auto initialize() noexcept -> error_code_t
+  {
+    const auto table_count = mp::cpu_count();
+    const auto table_list  = reinterpret_cast<table_t*>(logger::detail::allocate(sizeof(table_t) * table_count));
+
+    if (!table_list)
+    {
+      return make_error_code_t(std::errc::not_enough_memory);
+    }
+
+    memset(table_list, 0, sizeof(table_t) * table_count);
+
+    tsc_per_token_ = logger::detail::tsc_frequency() / HVPP_LOG_RATELIMIT_RATE;
+    if (!tsc_per_token_)
+    {
+      tsc_per_token_ = 1;
+    }
+
+    table_count_ = table_count;
+    table_list_  = table_list;
+
+    return {};
+  }
+
+  void destroy() noexcept
+  {
+    if (!table_list_)
+    {
+      return;
+    }
+
+    const auto table_list = table_list_;
+
+    table_list_  = nullptr;
+    table_count_ = 0;
+
+    logger::detail::free(table_list);
+  }
+
+  bool test(const void* site, uint32_t& suppressed) noexcept
+  {
+    suppressed = 0;
+
+    if (!table_list_)
+    {
+      return true;
+    }
+
+    auto& slot = table_list_[mp::cpu_index()].slot[slot_index(site)];
+    const auto now = ia32_asm_read_tsc();
+
+    if (slot.site != site)
+    {
+      slot.site       = site;
+      slot.last_tsc   = now;
+      slot.tokens     = HVPP_LOG_RATELIMIT_BURST;
+      slot.suppressed = 0;
+    }
+    else
+    {
+      //
+      // Refill the bucket.
+      //
+      const auto refill = (now - slot.last_tsc) / tsc_per_token_;
+
+      if (slot.tokens + refill >= HVPP_LOG_RATELIMIT_BURST)
+      {
+        slot.tokens   = HVPP_LOG_RATELIMIT_BURST;
+        slot.last_tsc = now;
+      }
+      else if (refill)
+      {
+        slot.tokens   += static_cast<uint32_t>(refill);
+        slot.last_tsc += refill * tsc_per_token_;
+      }
+    }
+
+    if (!slot.tokens)
+    {
+      slot.suppressed += 1;
+      return false;
+    }
+
+    slot.tokens -= 1;
+
+    suppressed = slot.suppressed;
+    slot.suppressed = 0;
+
+    return true;
+  }
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include "error.h"
+
+#include <cstdint>
+
+//
+// Rate limiting of the log call sites.
+//
+// Call sites which may be hit at very high frequency (e.g. when the
+// guest storms the hypervisor with EPT violations or exceptions) should
+// use the hvpp_*_ratelimited() macros (see log.h).  Each call site has
+// a token bucket: it may log at most HVPP_LOG_RATELIMIT_BURST messages
+// at once and HVPP_LOG_RATELIMIT_RATE messages per second on average.
+// Messages above this limit are dropped and counted - when the call site
+// is allowed to log again, the number of the suppressed messages is
+// logged first ("repeated N times").
+//
+// The state lives in per-CPU (cache-line aligned) tables, so the check
+// never touches memory shared with other CPUs.  Call sites are mapped
+// to the slots of the table by the hash of their address - when two
+// call sites collide, the slot is taken over by the last one (and the
+// suppressed count of the previous one is lost).
+//
+// Note that the check isn't protected against reentrancy (e.g. VM-exit
+// in the middle of the check called from the guest mode) - in such case
+// the counters may be slightly off, which is acceptable.
+//
+
+namespace logger::ratelimit
+{
+  static constexpr size_t slot_count = 64;
+
+  auto initialize() noexcept -> error_code_t;
+  void destroy() noexcept;
+
+  //
+  // Returns true if the call site "site" may log.  In that case,
+  // "suppressed" is set to number of messages of this call site which
+  // have been suppressed since the last logged one.
+  //
+  bool test(const void* site, uint32_t& suppressed) noexcept;
+}
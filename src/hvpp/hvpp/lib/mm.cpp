@@ -1,14 +1,19 @@
+#define HVPP_LOG_MODULE mm
+
 #include "mm.h"
 
 #include "assert.h"
 #include "mp.h"
-#include "../config.h"
+#include "percpu.h"
 
 namespace mm
 {
   struct global_t
   {
-    memory_allocator* allocator[HVPP_MAX_CPU];
+    //
+    // Current allocator of each CPU.
+    //
+    percpu::slot_t<memory_allocator*> allocator;
 
     memory_allocator* system_allocator;
     memory_allocator* custom_allocator;
@@ -16,6 +21,7 @@ namespace mm
     object_t<paging_descriptor_t> paging_descriptor;
     object_t<physical_memory_descriptor_t> physical_memory_descriptor;
     object_t<mtrr_descriptor_t> mtrr_descriptor;
+    object_t<direct_map_t> direct_map;
   };
 
   static global_t global;
@@ -39,6 +45,14 @@ namespace mm
 
   auto initialize() noexcept -> error_code_t
   {
+    //
+    // Reserve the per-CPU slot for the current allocator.
+    //
+    if (auto err = global.allocator.initialize())
+    {
+      return err;
+    }
+
     //
     // Initialize paging descriptor, physical memory descriptor
     // and MTRR descriptor.
@@ -47,6 +61,13 @@ namespace mm
     global.physical_memory_descriptor.initialize();
     global.mtrr_descriptor.initialize();
 
+    //
+    // Direct map is only constructed here, the paging structures
+    // are built by direct_map().initialize() (which requires
+    // memory allocator).
+    //
+    global.direct_map.initialize();
+
     return {};
   }
 
@@ -55,6 +76,7 @@ namespace mm
     //
     // Destroy all objects.
     //
+    global.direct_map.destroy();
     global.mtrr_descriptor.destroy();
     global.physical_memory_descriptor.destroy();
     global.paging_descriptor.destroy();
@@ -69,9 +91,9 @@ namespace mm
   {
     global.system_allocator = new_allocator;
 
-    for (auto& allocator_item : global.allocator)
+    for (uint32_t cpu_index = 0; cpu_index < mp::cpu_count(); ++cpu_index)
     {
-      allocator_item = global.system_allocator;
+      global.allocator.get(cpu_index) = global.system_allocator;
     }
   }
 
@@ -87,13 +109,13 @@ namespace mm
 
   auto allocator() noexcept -> memory_allocator*
   {
-    return global.allocator[mp::cpu_index()];
+    return global.allocator.get();
   }
 
   void allocator(memory_allocator* new_allocator) noexcept
   {
     hvpp_assert(new_allocator);
-    global.allocator[mp::cpu_index()] = new_allocator;
+    global.allocator.get() = new_allocator;
   }
 
   auto paging_descriptor() noexcept -> const paging_descriptor_t&
@@ -110,18 +132,30 @@ namespace mm
   {
     return *global.mtrr_descriptor;
   }
+
+  auto direct_map() noexcept -> direct_map_t&
+  {
+    return *global.direct_map;
+  }
+
+  auto host_cr3() noexcept -> cr3_t
+  {
+    return global.direct_map->is_initialized()
+      ? global.direct_map->cr3()
+      : global.paging_descriptor->system_cr3();
+  }
 }
 
 namespace detail
 {
   void* generic_allocate(size_t size) noexcept
   {
-    return mm::global.allocator[mp::cpu_index()]->allocate(size);
+    return mm::global.allocator.get()->allocate(size);
   }
 
   void* generic_allocate_aligned(size_t size, std::align_val_t alignment) noexcept
   {
-    return mm::global.allocator[mp::cpu_index()]->allocate_aligned(size, static_cast<size_t>(alignment));
+    return mm::global.allocator.get()->allocate_aligned(size, static_cast<size_t>(alignment));
   }
 
   void generic_free(void* address) noexcept
@@ -9,6 +9,7 @@
 #include "mm/paging_descriptor.h"
 #include "mm/physical_memory_descriptor.h"
 #include "mm/mtrr_descriptor.h"
+#include "mm/direct_map.h"
 
 #include <cstdint>
 
@@ -45,6 +46,17 @@ namespace mm
   auto physical_memory_descriptor() noexcept -> const physical_memory_descriptor_t&;
   auto mtrr_descriptor() noexcept -> const mtrr_descriptor_t&;
 
+  //
+  // Direct map of the physical memory (see direct_map_t).
+  //
+  auto direct_map() noexcept -> direct_map_t&;
+
+  //
+  // CR3 which should be used as HOST_CR3 - CR3 of the direct map
+  // if it has been initialized, "System" CR3 otherwise.
+  //
+  auto host_cr3() noexcept -> cr3_t;
+
   //
   // Allocator guard.
   //
@@ -0,0 +1,375 @@
+#define HVPP_LOG_MODULE mm
+
+#include "direct_map.h"
+
+#include "../assert.h"
+#include "../log.h"
+#include "../mm.h"
+
+#include <cinttypes>
+#include <cstring>
+
+namespace mm
+{
+  namespace detail
+  {
+    static bool cpu_has_1gb_pages() noexcept
+    {
+      //
+      // CPUID.80000001H:EDX.Page1GB [bit 26].
+      // (ref: Vol3A[4.1.4(Enumeration of Paging Features by CPUID)])
+      //
+      uint32_t cpu_info[4];
+      ia32_asm_cpuid(cpu_info, 0x8000'0000);
+
+      if (cpu_info[0] < 0x8000'0001)
+      {
+        return false;
+      }
+
+      ia32_asm_cpuid(cpu_info, 0x8000'0001);
+      return !!(cpu_info[3] & (1 << 26));
+    }
+  }
+
+  direct_map_t::direct_map_t() noexcept
+    : pml4_{}
+    , pml4_index_{}
+    , pml4_count_{}
+    , base_{}
+    , cr3_{}
+    , range_{}
+    , range_count_{}
+    , has_1gb_pages_{}
+  {
+
+  }
+
+  direct_map_t::~direct_map_t() noexcept
+  {
+    destroy();
+  }
+
+  auto direct_map_t::initialize() noexcept -> error_code_t
+  {
+    hvpp_assert(!pml4_);
+
+    //
+    // Determine how many PML4 entries (512GB each) are required
+    // to cover the highest physical address.
+    //
+    pa_t max_pa = 0;
+    for (auto& range : physical_memory_descriptor())
+    {
+      if (range.end() > max_pa)
+      {
+        max_pa = range.end();
+      }
+    }
+
+    const auto pml4_count = static_cast<size_t>(
+      (page_align_up(max_pa.value(), pml4_t{}) >> pml4_t::shift));
+
+    if (pml4_count == 0 || pml4_count > max_pml4_count)
+    {
+      return make_error_code_t(std::errc::not_supported);
+    }
+
+    //
+    // Make a private copy of the "System" PML4.
+    //
+    // Note that only the PML4 is copied - lower-level paging
+    // structures are shared with the OS.  This also means that
+    // the self-referencing PML4 entry still points to the original
+    // PML4 - therefore va_t::pt_entry() (and memory_mapper, which
+    // relies on it) keep working with the original page-tables.
+    //
+    pml4_ = table_allocate();
+    if (!pml4_)
+    {
+      return make_error_code_t(std::errc::not_enough_memory);
+    }
+
+    const auto system_cr3 = paging_descriptor().system_cr3();
+    const auto system_pml4 = reinterpret_cast<const pe_t*>(
+      pa_t::from_pfn(system_cr3.page_frame_number).va());
+
+    memcpy(pml4_, system_pml4, page_size);
+
+    //
+    // Find "pml4_count" consecutive unused PML4 entries in the kernel
+    // half of the address space.
+    //
+    size_t pml4_index = pml4_t::count / 2;
+    while (pml4_index + pml4_count <= pml4_t::count)
+    {
+      size_t i = 0;
+      while (i < pml4_count && !pml4_[pml4_index + i].present)
+      {
+        ++i;
+      }
+
+      if (i == pml4_count)
+      {
+        break;
+      }
+
+      pml4_index += i + 1;
+    }
+
+    if (pml4_index + pml4_count > pml4_t::count)
+    {
+      destroy();
+      return make_error_code_t(std::errc::not_enough_memory);
+    }
+
+    pml4_index_ = pml4_index;
+    pml4_count_ = pml4_count;
+    has_1gb_pages_ = detail::cpu_has_1gb_pages();
+
+    //
+    // Map all physical memory ranges.
+    //
+    // Similarly to ept_t::map_identity_sparse(), ranges are rounded
+    // to 2MB boundaries and 2MB pages (or 1GB pages, if the CPU
+    // supports them and the range covers whole 1GB) are used.
+    // This keeps number of allocated paging structures (and TLB
+    // misses) low.
+    //
+    for (auto& range : physical_memory_descriptor())
+    {
+      auto from = pa_t{ page_align   (range.begin().value(), pd_t{}) };
+      auto to   = pa_t{ page_align_up(range.end().value(),   pd_t{}) };
+
+      for (pa_t pa = from; pa < to; )
+      {
+        error_code_t err;
+
+        if (has_1gb_pages_ &&
+            page_align(pa.value(), pdpt_t{}) == pa.value() &&
+            pa + pdpt_t::size <= to)
+        {
+          err = map_1gb(pa);
+          pa += pdpt_t::size;
+        }
+        else
+        {
+          err = map_2mb(pa);
+          pa += pd_t::size;
+        }
+
+        if (err)
+        {
+          destroy();
+          return err;
+        }
+      }
+
+      if (range_count_ < max_range_count)
+      {
+        range_[range_count_++] = range;
+      }
+    }
+
+    //
+    // Keep PCID (and flags) of the "System" CR3.
+    //
+    cr3_ = system_cr3;
+    cr3_.page_frame_number = pa_t::from_va(pml4_).pfn();
+
+    //
+    // Canonical address of the first PML4 entry of the direct map.
+    //
+    base_ = reinterpret_cast<uint8_t*>(0xffff'0000'0000'0000 | (uint64_t(pml4_index_) << pml4_t::shift));
+
+    return {};
+  }
+
+  void direct_map_t::destroy() noexcept
+  {
+    if (!pml4_)
+    {
+      return;
+    }
+
+    //
+    // Free only paging structures created by us - everything else
+    // belongs to the OS.
+    //
+    for (size_t i = 0; i < pml4_count_; ++i)
+    {
+      const auto& pml4e = pml4_[pml4_index_ + i];
+
+      if (!pml4e.present)
+      {
+        continue;
+      }
+
+      const auto pdpt = reinterpret_cast<pe_t*>(pa_t::from_pfn(pml4e.page_frame_number).va());
+
+      for (size_t j = 0; j < pdpt_t::count; ++j)
+      {
+        const auto& pdpte = pdpt[j];
+
+        if (pdpte.present && !pdpte.large_page)
+        {
+          delete[] reinterpret_cast<pe_t*>(pa_t::from_pfn(pdpte.page_frame_number).va());
+        }
+      }
+
+      delete[] pdpt;
+    }
+
+    delete[] pml4_;
+
+    pml4_ = nullptr;
+    pml4_index_ = 0;
+    pml4_count_ = 0;
+    base_ = nullptr;
+    cr3_ = cr3_t{};
+    range_count_ = 0;
+  }
+
+  void direct_map_t::dump() const noexcept
+  {
+    hvpp_info("Direct map");
+
+    if (!base_)
+    {
+      hvpp_info("  (not initialized)");
+      return;
+    }
+
+    hvpp_info("  Base                      - %016" PRIx64, reinterpret_cast<uint64_t>(base_));
+    hvpp_info("  PML4 index                - %u (count: %u)", static_cast<uint32_t>(pml4_index_),
+                                                              static_cast<uint32_t>(pml4_count_));
+    hvpp_info("  CR3                       - %016" PRIx64, cr3_.flags);
+    hvpp_info("  1GB pages                 - %s", has_1gb_pages_ ? "yes" : "no");
+  }
+
+  auto direct_map_t::table_allocate() noexcept -> pe_t*
+  {
+    //
+    // See ept_t::map_subtable() for explanation of this syntax.
+    //
+    const auto table = reinterpret_cast<pe_t*>(operator new[](sizeof(pe_t) * 512, std::align_val_t(page_size)));
+
+    if (table)
+    {
+      memset(table, 0, page_size);
+    }
+
+    return table;
+  }
+
+  auto direct_map_t::table_entry(pe_t& entry) noexcept -> pe_t*
+  {
+    //
+    // Return paging structure referenced by this entry.
+    // Create it if it doesn't exist.
+    //
+    if (entry.present)
+    {
+      return reinterpret_cast<pe_t*>(pa_t::from_pfn(entry.page_frame_number).va());
+    }
+
+    const auto table = table_allocate();
+    if (!table)
+    {
+      return nullptr;
+    }
+
+    entry.flags = 0;
+    entry.present = true;
+    entry.write = true;
+    entry.page_frame_number = pa_t::from_va(table).pfn();
+
+    return table;
+  }
+
+  auto direct_map_t::map_1gb(pa_t pa) noexcept -> error_code_t
+  {
+    const auto pdpt = table_entry(pml4_[pml4_index_ + pa.offset(pml::pml4)]);
+    if (!pdpt)
+    {
+      return make_error_code_t(std::errc::not_enough_memory);
+    }
+
+    auto& pdpte = pdpt[pa.offset(pml::pdpt)];
+
+    if (pdpte.present)
+    {
+      if (pdpte.large_page)
+      {
+        return {};
+      }
+
+      //
+      // Part of this 1GB region has been already mapped by 2MB pages
+      // (end of the previous range has been rounded up) - map the rest
+      // of it by 2MB pages too.
+      //
+      for (size_t i = 0; i < pd_t::count; ++i)
+      {
+        if (auto err = map_2mb(pa + i * pd_t::size))
+        {
+          return err;
+        }
+      }
+
+      return {};
+    }
+
+    //
+    // Present, writable, non-executable and not accessible
+    // from user-mode.  Not global - the mapping is valid only
+    // in the address space of our CR3.
+    //
+    pdpte.flags = 0;
+    pdpte.present = true;
+    pdpte.write = true;
+    pdpte.large_page = true;
+    pdpte.execute_disable = true;
+    pdpte.page_frame_number = pa.pfn();
+
+    return {};
+  }
+
+  auto direct_map_t::map_2mb(pa_t pa) noexcept -> error_code_t
+  {
+    const auto pdpt = table_entry(pml4_[pml4_index_ + pa.offset(pml::pml4)]);
+    if (!pdpt)
+    {
+      return make_error_code_t(std::errc::not_enough_memory);
+    }
+
+    auto& pdpte = pdpt[pa.offset(pml::pdpt)];
+
+    if (pdpte.present && pdpte.large_page)
+    {
+      return {};
+    }
+
+    const auto pd = table_entry(pdpte);
+    if (!pd)
+    {
+      return make_error_code_t(std::errc::not_enough_memory);
+    }
+
+    auto& pde = pd[pa.offset(pml::pd)];
+
+    if (pde.present)
+    {
+      return {};
+    }
+
+    pde.flags = 0;
+    pde.present = true;
+    pde.write = true;
+    pde.large_page = true;
+    pde.execute_disable = true;
+    pde.page_frame_number = pa.pfn();
+
+    return {};
+  }
+}
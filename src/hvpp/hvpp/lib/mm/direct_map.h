@@ -0,0 +1,106 @@
+#pragma once
+#include "hvpp/ia32/memory.h"
+
+#include "../error.h"
+
+#include <cstdint>
+
+namespace mm
+{
+  using namespace ia32;
+
+  //
+  // Direct map of the physical memory for the hypervisor (host).
+  //
+  // The direct map is built once (before the hypervisor is started)
+  // in a private copy of the "System" PML4 - all entries of the
+  // original PML4 are preserved and unused PML4 entries from the
+  // kernel half of the address space are filled with 1GB (if
+  // supported by the CPU) or 2MB pages, which map physical memory
+  // ranges described by physical_memory_descriptor().
+  //
+  // CR3 of this copy (cr3()) is then used as HOST_CR3.  Therefore,
+  // the direct map is visible only in the VMX-root mode and the
+  // original page-tables of the OS are not modified.
+  //
+  // While in VMX-root mode, physical memory can be then accessed
+  // by plain pointer arithmetic (see va()) instead of remapping
+  // of the memory_mapper window.
+  //
+  // Note that PML4 entries created by the OS after the copy has
+  // been made are not reflected in the copy.  Hypervisor doesn't
+  // access such memory, though (its memory is allocated before
+  // the hypervisor is started).
+  //
+
+  class direct_map_t
+  {
+    public:
+      static constexpr size_t max_pml4_count  = 4;  // 2TB
+      static constexpr size_t max_range_count = 32;
+
+      direct_map_t() noexcept;
+      direct_map_t(const direct_map_t& other) noexcept = delete;
+      direct_map_t(direct_map_t&& other) noexcept = delete;
+      direct_map_t& operator=(const direct_map_t& other) noexcept = delete;
+      direct_map_t& operator=(direct_map_t&& other) noexcept = delete;
+      ~direct_map_t() noexcept;
+
+      auto initialize() noexcept -> error_code_t;
+      void destroy() noexcept;
+
+      bool is_initialized() const noexcept
+      { return base_ != nullptr; }
+
+      //
+      // CR3 of the page-tables with the direct map.
+      //
+      auto cr3() const noexcept -> cr3_t
+      { return cr3_; }
+
+      //
+      // Return virtual address of the physical memory range
+      // [pa, pa + size) or nullptr if it isn't covered by the
+      // direct map or if the direct map isn't active (i.e.
+      // current CR3 isn't cr3()).
+      //
+      void* va(pa_t pa, size_t size) const noexcept
+      {
+        if (!base_ || read<cr3_t>().page_frame_number != cr3_.page_frame_number)
+        {
+          return nullptr;
+        }
+
+        for (size_t i = 0; i < range_count_; ++i)
+        {
+          if (pa >= range_[i].begin() && pa + size <= range_[i].end())
+          {
+            return base_ + pa.value();
+          }
+        }
+
+        return nullptr;
+      }
+
+      void dump() const noexcept;
+
+    private:
+      auto  table_allocate() noexcept -> pe_t*;
+      auto  table_entry(pe_t& entry) noexcept -> pe_t*;
+
+      auto  map_1gb(pa_t pa) noexcept -> error_code_t;
+      auto  map_2mb(pa_t pa) noexcept -> error_code_t;
+
+      pe_t*                 pml4_;
+      size_t                pml4_index_;
+      size_t                pml4_count_;
+
+      uint8_t*              base_;
+      cr3_t                 cr3_;
+
+      physical_memory_range range_[max_range_count];
+      size_t                range_count_;
+
+      bool                  has_1gb_pages_;
+  };
+}
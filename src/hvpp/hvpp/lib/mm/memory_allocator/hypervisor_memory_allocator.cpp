@@ -1,3 +1,5 @@
+#define HVPP_LOG_MODULE mm
+
 #include "hypervisor_memory_allocator.h"
 
 #include "../../assert.h"
@@ -52,7 +54,7 @@ namespace mm
     , last_page_offset_{}
     , allocated_bytes_{}
     , free_bytes_{}
-    , lock_{}
+    , lock_{ "hypervisor_memory_allocator" }
   {
 
   }
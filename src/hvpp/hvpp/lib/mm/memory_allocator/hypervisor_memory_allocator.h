@@ -3,7 +3,7 @@
 
 #include "../../bitmap.h"
 #include "../../object.h"
-#include "../../spinlock.h"
+#include "../../spinlock_stats.h"
 
 namespace mm
 {
@@ -44,6 +44,6 @@ namespace mm
       size_t      allocated_bytes_;
       size_t      free_bytes_;
 
-      spinlock    lock_;
+      instrumented_lock<spinlock> lock_;
   };
 }
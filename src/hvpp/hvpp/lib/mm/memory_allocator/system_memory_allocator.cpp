@@ -1,3 +1,5 @@
+#define HVPP_LOG_MODULE mm
+
 #include "system_memory_allocator.h"
 
 namespace mm
@@ -1,23 +1,49 @@
+#define HVPP_LOG_MODULE mm
+
 #include "memory_mapper.h"
 
+#include "../assert.h"
+#include "../mm.h"
+
+#include <algorithm>
+
+#ifdef min
+# undef min
+#endif
+
 namespace mm
 {
-  memory_mapper::memory_mapper() noexcept
+  memory_mapper::memory_mapper(size_t slot_count /* = default_slot_count */) noexcept
+    : slot_{}
+    , slot_count_{ std::min(slot_count, max_slot_count) }
+    , tick_{}
   {
+    hvpp_assert(slot_count > 0 && slot_count <= max_slot_count);
+
     //
-    // Reserve 1 page of the virtual address space.
+    // Reserve "slot_count" pages of the virtual address space.
     // Note that the memory is NOT allocated, just reserved.
     //
-    va_ = detail::mapper_allocate(page_size);
+    va_ = detail::mapper_allocate(slot_count_ * page_size);
 
     //
-    // Get page-table entry for the virtual address.
+    // Get page-table entry for each virtual address.
     //
-    pte_ = va_t(va_).pt_entry();
+    for (size_t i = 0; i < slot_count_; ++i)
+    {
+      slot_[i].pte = va_t(reinterpret_cast<uint8_t*>(va_) + i * page_size).pt_entry();
+      slot_[i].pfn = pfn_none;
+      slot_[i].last_used = 0;
+    }
   }
 
   memory_mapper::~memory_mapper() noexcept
   {
+    //
+    // Reserved mapping must not be mapped when it's released.
+    //
+    unmap();
+
     //
     // Release the virtual address space.
     //
@@ -26,34 +52,89 @@ namespace mm
 
   void* memory_mapper::map(pa_t pa) noexcept
   {
-    //
-    // Make this entry present & writable.
-    //
-    pte_->present = true;
-    pte_->write = true;
+    if (const auto va = direct_map().va(pa, page_size - byte_offset(pa.value())))
+    {
+      return va;
+    }
 
-    //
-    // Do not flush this page from the TLB on CR3 switch.
-    //
-    pte_->global = true;
+    size_t slot_index;
+    if (slot_acquire(pa.pfn(), slot_index))
+    {
+      ia32_asm_inv_page(slot_va(slot_index, pa_t{}));
+    }
+
+    return slot_va(slot_index, pa);
+  }
+
+  void memory_mapper::map(const pa_t* pa_list, void** va_list, size_t count) noexcept
+  {
+    hvpp_assert(count <= slot_count_);
 
     //
-    // Set the PFN of this PTE to the PFN of the
-    // provided physical address.
+    // First, mark slots which already map requested pages as
+    // recently used - so that they're not evicted by the other
+    // pages of this request.
     //
-    pte_->page_frame_number = pa.pfn();
-
+    // Then, assign slots to the rest of the pages (updating
+    // page-table entries) and invalidate only slots which
+    // previously mapped something else.  Slots which weren't
+    // present don't have to be invalidated - non-present
+    // translations are never cached in the TLB.
     //
-    // Finally, invalidate the cache for the virtual address.
+    // Pages covered by the direct map don't need any slot.
     //
-    ia32_asm_inv_page(va_);
+    const auto tick = ++tick_;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+      va_list[i] = direct_map().va(pa_list[i], page_size - byte_offset(pa_list[i].value()));
+
+      if (va_list[i])
+      {
+        continue;
+      }
+
+      for (size_t slot_index = 0; slot_index < slot_count_; ++slot_index)
+      {
+        if (slot_[slot_index].pfn == pa_list[i].pfn())
+        {
+          slot_[slot_index].last_used = tick;
+          va_list[i] = slot_va(slot_index, pa_list[i]);
+          break;
+        }
+      }
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+      if (va_list[i])
+      {
+        continue;
+      }
+
+      size_t slot_index;
+      if (slot_acquire(pa_list[i].pfn(), slot_index))
+      {
+        ia32_asm_inv_page(slot_va(slot_index, pa_t{}));
+      }
 
-    return reinterpret_cast<uint8_t*>(va_) + byte_offset(pa.value());
+      slot_[slot_index].last_used = tick;
+      va_list[i] = slot_va(slot_index, pa_list[i]);
+    }
   }
 
   void memory_mapper::unmap() noexcept
   {
-    pte_->flags = 0;
+    for (size_t i = 0; i < slot_count_; ++i)
+    {
+      if (slot_[i].pfn != pfn_none)
+      {
+        slot_[i].pte->flags = 0;
+        slot_[i].pfn = pfn_none;
+
+        ia32_asm_inv_page(slot_va(i, pa_t{}));
+      }
+    }
   }
 
   void memory_mapper::read(pa_t pa, void* buffer, size_t size) noexcept
@@ -71,33 +152,129 @@ namespace mm
     auto byte_buffer = reinterpret_cast<uint8_t*>(buffer);
 
     //
-    // Map each page of the physical memory to the reserved
-    // system virtual address and then copy.
+    // If the physical memory is covered by the direct map (and we're
+    // running with its CR3), just copy - no remapping is needed.
+    //
+    if (const auto va = direct_map().va(pa, size))
+    {
+      if (write)
+      {
+        memcpy(va, byte_buffer, size);
+      }
+      else
+      {
+        memcpy(byte_buffer, va, size);
+      }
+
+      return;
+    }
+
+    //
+    // Map pages of the physical memory to the reserved system
+    // virtual address window (as many of them as fits into the
+    // window at once) and then copy.
     //
     while (size != 0)
     {
-      auto va = map(pa);
-      auto bytes_to_copy = page_size - byte_offset(va);
+      pa_t  pa_list[max_slot_count];
+      void* va_list[max_slot_count];
+
+      size_t count = 0;
+      size_t bytes_remaining = size;
+      pa_t   pa_current = pa;
 
-      if (bytes_to_copy > size)
+      while (bytes_remaining != 0 && count < slot_count_)
       {
-        bytes_to_copy = size;
+        auto bytes_in_page = page_size - byte_offset(pa_current.value());
+
+        if (bytes_in_page > bytes_remaining)
+        {
+          bytes_in_page = bytes_remaining;
+        }
+
+        pa_list[count++]  = pa_current;
+        pa_current       += bytes_in_page;
+        bytes_remaining  -= bytes_in_page;
       }
 
-      if (write)
+      map(pa_list, va_list, count);
+
+      for (size_t i = 0; i < count; ++i)
       {
-        memcpy(va, byte_buffer, bytes_to_copy);
+        auto bytes_to_copy = page_size - byte_offset(pa.value());
+
+        if (bytes_to_copy > size)
+        {
+          bytes_to_copy = size;
+        }
+
+        if (write)
+        {
+          memcpy(va_list[i], byte_buffer, bytes_to_copy);
+        }
+        else
+        {
+          memcpy(byte_buffer, va_list[i], bytes_to_copy);
+        }
+
+        byte_buffer += bytes_to_copy;
+        pa          += bytes_to_copy;
+        size        -= bytes_to_copy;
       }
-      else
+    }
+  }
+
+  bool memory_mapper::slot_acquire(uint64_t pfn, size_t& slot_index) noexcept
+  {
+    const auto tick = ++tick_;
+
+    size_t lru_index = 0;
+
+    for (size_t i = 0; i < slot_count_; ++i)
+    {
+      if (slot_[i].pfn == pfn)
       {
-        memcpy(byte_buffer, va, bytes_to_copy);
+        slot_[i].last_used = tick;
+        slot_index = i;
+        return false;
       }
 
-      byte_buffer += bytes_to_copy;
-      pa          += bytes_to_copy;
-      size        -= bytes_to_copy;
-
-      unmap();
+      if (slot_[i].last_used < slot_[lru_index].last_used)
+      {
+        lru_index = i;
+      }
     }
+
+    auto& slot = slot_[lru_index];
+    const bool was_present = slot.pfn != pfn_none;
+
+    //
+    // Make this entry present & writable.
+    //
+    // Do not flush this page from the TLB on CR3 switch
+    // (global).
+    //
+    // Set the PFN of this PTE to the PFN of the provided
+    // physical address.
+    //
+    pe_t pte{};
+    pte.present = true;
+    pte.write = true;
+    pte.global = true;
+    pte.page_frame_number = pfn;
+
+    slot.pte->flags = pte.flags;
+    slot.pfn = pfn;
+    slot.last_used = tick;
+
+    slot_index = lru_index;
+    return was_present;
+  }
+
+  void* memory_mapper::slot_va(size_t slot_index, pa_t pa) const noexcept
+  {
+    return reinterpret_cast<uint8_t*>(va_)
+         + slot_index * page_size
+         + byte_offset(pa.value());
   }
 }
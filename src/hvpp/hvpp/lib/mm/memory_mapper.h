@@ -14,11 +14,29 @@ namespace mm
   //
   // Class for reading/writing physical memory.
   //
+  // The mapper reserves window of "slot_count" pages of the virtual
+  // address space.  Each slot maps one physical page.  Slots are
+  // reused in LRU fashion - mapping of a page that is already mapped
+  // in some slot doesn't touch the page-table at all (and doesn't
+  // invalidate the TLB).  This makes repeated accesses to the same
+  // pages (e.g. guest page-tables) cheap.
+  //
+  // Pointers returned by map() are valid until the slot is reused,
+  // i.e. until "slot_count" other pages are mapped.  If the page is
+  // covered by the direct map (see direct_map_t), pointer into the
+  // direct map is returned instead and no slot is used.
+  //
+  // Note that the mapper is not thread-safe - each VCPU should have
+  // its own instance.
+  //
 
   class memory_mapper
   {
     public:
-      memory_mapper() noexcept;
+      static constexpr size_t max_slot_count     = 64;
+      static constexpr size_t default_slot_count = 16;
+
+      memory_mapper(size_t slot_count = default_slot_count) noexcept;
       ~memory_mapper() noexcept;
 
       memory_mapper(const memory_mapper& other) noexcept = delete;
@@ -26,16 +44,52 @@ namespace mm
       memory_mapper& operator=(const memory_mapper& other) noexcept = delete;
       memory_mapper& operator=(memory_mapper&& other) noexcept = delete;
 
+      //
+      // Map single physical page.
+      //
       void* map(pa_t pa) noexcept;
+
+      //
+      // Map list of (possibly scattered) physical addresses in one
+      // pass.  Virtual address of each physical address is stored
+      // in "va_list".  Count must not exceed slot_count().
+      //
+      void  map(const pa_t* pa_list, void** va_list, size_t count) noexcept;
+
+      //
+      // Unmap all slots.
+      //
       void  unmap() noexcept;
 
       void  read(pa_t pa, void* buffer, size_t size) noexcept;
       void  write(pa_t pa, const void* buffer, size_t size) noexcept;
 
+      size_t slot_count() const noexcept
+      { return slot_count_; }
+
     private:
+      struct slot_t
+      {
+        pe_t*    pte;
+        uint64_t pfn;
+        uint64_t last_used;
+      };
+
+      static constexpr uint64_t pfn_none = ~uint64_t(0);
+
       void  read_write(pa_t pa, void* buffer, size_t size, bool write) noexcept;
 
-      void* va_;
-      pe_t* pte_;
+      //
+      // Find slot which maps the PFN or assign the least-recently
+      // used one.  Returns true if the PTE of the slot must be
+      // invalidated.
+      //
+      bool  slot_acquire(uint64_t pfn, size_t& slot_index) noexcept;
+      void* slot_va(size_t slot_index, pa_t pa) const noexcept;
+
+      void*    va_;
+      slot_t   slot_[max_slot_count];
+      size_t   slot_count_;
+      uint64_t tick_;
   };
 }
@@ -1,10 +1,20 @@
+#define HVPP_LOG_MODULE mm
+
 #include "memory_translator.h"
 
 #include "../mm.h"
 
+#include <algorithm>
+
 namespace mm
 {
   memory_translator::memory_translator() noexcept
+    : tlb_{}
+    , pde_cache_{}
+    , generation_{ 1 }
+    , cache_persistent_{}
+    , hit_count_{}
+    , miss_count_{}
   { }
 
   memory_translator::~memory_translator() noexcept
@@ -20,6 +30,62 @@ namespace mm
     return read_write(va, cr3, const_cast<void*>(buffer), size, true, ignore_errors);
   }
 
+  size_t memory_translator::read_batch(batch_entry_t* entry_list, size_t count, cr3_t cr3, bool ignore_errors /* = false */) noexcept
+  {
+    batch_chunk_t chunk_list[batch_chunk_max];
+    size_t chunk_count = 0;
+
+    //
+    // Split each request into chunks which don't cross page boundary.
+    // If there are more chunks than fits into the chunk list, process
+    // them in multiple rounds.
+    //
+    for (size_t i = 0; i < count; ++i)
+    {
+      auto& entry = entry_list[i];
+      entry.result = va_t{};
+
+      auto   va     = entry.va;
+      size_t offset = 0;
+
+      while (offset < entry.size)
+      {
+        if (chunk_count == batch_chunk_max)
+        {
+          read_batch_chunks(entry_list, chunk_list, chunk_count, cr3, ignore_errors);
+          chunk_count = 0;
+        }
+
+        auto bytes_in_page = page_size - byte_offset(va.value());
+
+        if (bytes_in_page > entry.size - offset)
+        {
+          bytes_in_page = entry.size - offset;
+        }
+
+        chunk_list[chunk_count++] = batch_chunk_t{
+          page_align(va.value(), pt_t{}),
+          static_cast<uint32_t>(i),
+          static_cast<uint32_t>(byte_offset(va.value())),
+          static_cast<uint32_t>(bytes_in_page),
+          offset
+        };
+
+        va     += bytes_in_page;
+        offset += bytes_in_page;
+      }
+    }
+
+    if (chunk_count)
+    {
+      read_batch_chunks(entry_list, chunk_list, chunk_count, cr3, ignore_errors);
+    }
+
+    return std::count_if(entry_list, entry_list + count, [](const batch_entry_t& entry) {
+      return !!entry.result;
+    });
+  }
+
   pa_t memory_translator::va_to_pa(va_t va) noexcept
   {
     const auto pml4_base = paging_descriptor().pml4_base();
@@ -68,56 +134,201 @@ namespace mm
 
   pa_t memory_translator::va_to_pa(va_t va, cr3_t cr3) noexcept
   {
-    pe_t pml4e;
-    mapper_.read(pa_t::from_pfn(cr3.page_frame_number)
-               + va.offset(pml::pml4) * sizeof(pe_t),
-                 &pml4e, sizeof(pml4e));
-    if (!pml4e.present)
+    return translate(va, cr3).pa;
+  }
+
+  auto memory_translator::translate(va_t va, cr3_t cr3) noexcept -> translation_t
+  {
+    const auto cr3_pfn = uint64_t(cr3.page_frame_number);
+
+    if (const auto entry = cache_lookup(tlb_, va.value() >> pt_t::shift, cr3_pfn))
     {
-      return {};
+      hit_count_ += 1;
+
+      return translation_t{
+        pa_t::from_pfn(entry->pfn) + byte_offset(va.value()),
+        entry->size,
+        entry->write,
+        entry->user,
+        entry->execute
+      };
     }
 
-    pe_t pdpte;
-    mapper_.read(pa_t::from_pfn(pml4e.page_frame_number)
-               + va.offset(pml::pdpt) * sizeof(pe_t),
-                 &pdpte, sizeof(pdpte));
-    if (!pdpte.present)
+    miss_count_ += 1;
+
+    //
+    // Access rights are combined from all paging-structure entries
+    // used for the translation.
+    // (ref: Vol3A[4.6(Access Rights)])
+    //
+    // Note that the "supervisor" field is the U/S flag (set = user-mode
+    // accesses are allowed).
+    //
+    translation_t result{};
+    result.write   = true;
+    result.user    = true;
+    result.execute = true;
+
+    const auto combine = [&result](const pe_t& pe) {
+      result.write   = result.write   && pe.write;
+      result.user    = result.user    && pe.supervisor;
+      result.execute = result.execute && !pe.execute_disable;
+    };
+
+    uint64_t pt_pfn;
+
+    if (const auto entry = cache_lookup(pde_cache_, va.value() >> pd_t::shift, cr3_pfn))
+    {
+      //
+      // Page table of this 2MB region is known - skip the walk
+      // of the upper levels.
+      //
+      pt_pfn = entry->pfn;
+
+      result.write   = entry->write;
+      result.user    = entry->user;
+      result.execute = entry->execute;
+    }
+    else
+    {
+      pe_t pml4e;
+      mapper_.read(pa_t::from_pfn(cr3.page_frame_number)
+                 + va.offset(pml::pml4) * sizeof(pe_t),
+                   &pml4e, sizeof(pml4e));
+      if (!pml4e.present)
+      {
+        return {};
+      }
+
+      combine(pml4e);
+
+      pe_t pdpte;
+      mapper_.read(pa_t::from_pfn(pml4e.page_frame_number)
+                 + va.offset(pml::pdpt) * sizeof(pe_t),
+                   &pdpte, sizeof(pdpte));
+      if (!pdpte.present)
+      {
+        return {};
+      }
+
+      combine(pdpte);
+
+      if (pdpte.large_page)
+      {
+        result.pa = pa_t::from_pfn(pdpte.page_frame_number)
+                  + byte_offset(va.value(), pdpt_t{});
+        result.size = pdpt_t::size;
+
+        cache_insert(tlb_, va.value() >> pt_t::shift, cr3_pfn, result.pa.pfn(), result);
+        return result;
+      }
+
+      pe_t pde;
+      mapper_.read(pa_t::from_pfn(pdpte.page_frame_number)
+                 + va.offset(pml::pd) * sizeof(pe_t),
+                   &pde, sizeof(pde));
+      if (!pde.present)
+      {
+        return {};
+      }
+
+      combine(pde);
+
+      if (pde.large_page)
+      {
+        result.pa = pa_t::from_pfn(pde.page_frame_number)
+                  + byte_offset(va.value(), pd_t{});
+        result.size = pd_t::size;
+
+        cache_insert(tlb_, va.value() >> pt_t::shift, cr3_pfn, result.pa.pfn(), result);
+        return result;
+      }
+
+      pt_pfn = pde.page_frame_number;
+      cache_insert(pde_cache_, va.value() >> pd_t::shift, cr3_pfn, pt_pfn, result);
+    }
+
+    pe_t pte;
+    mapper_.read(pa_t::from_pfn(pt_pfn)
+               + va.offset(pml::pt) * sizeof(pe_t),
+                 &pte, sizeof(pte));
+    if (!pte.present)
     {
       return {};
     }
 
-    if (pdpte.large_page)
+    combine(pte);
+
+    result.pa = pa_t::from_pfn(pte.page_frame_number)
+              + byte_offset(va.value());
+    result.size = pt_t::size;
+
+    cache_insert(tlb_, va.value() >> pt_t::shift, cr3_pfn, pte.page_frame_number, result);
+    return result;
+  }
+
+  void memory_translator::flush() noexcept
+  {
+    generation_ += 1;
+  }
+
+  void memory_translator::flush(va_t va) noexcept
+  {
+    const auto tag = va.value() >> pt_t::shift;
+
+    for (auto& entry : tlb_)
     {
-      return pa_t::from_pfn(pdpte.page_frame_number)
-           + byte_offset(va.value(), pdpt_t{});
+      if (entry.tag == tag)
+      {
+        entry.generation = 0;
+      }
     }
 
-    pe_t pde;
-    mapper_.read(pa_t::from_pfn(pdpte.page_frame_number)
-               + va.offset(pml::pd) * sizeof(pe_t),
-                 &pde, sizeof(pde));
-    if (!pde.present)
+    for (auto& entry : pde_cache_)
     {
-      return {};
+      entry.generation = 0;
     }
+  }
+
+  void memory_translator::flush(cr3_t cr3) noexcept
+  {
+    const auto cr3_pfn = uint64_t(cr3.page_frame_number);
 
-    if (pde.large_page)
+    for (auto& entry : tlb_)
     {
-      return pa_t::from_pfn(pde.page_frame_number)
-           + byte_offset(va.value(), pd_t{});
+      if (entry.cr3_pfn == cr3_pfn)
+      {
+        entry.generation = 0;
+      }
     }
 
-    pe_t pte;
-    mapper_.read(pa_t::from_pfn(pde.page_frame_number)
-               + va.offset(pml::pt) * sizeof(pe_t),
-                 &pte, sizeof(pte));
-    if (!pte.present)
+    for (auto& entry : pde_cache_)
     {
-      return {};
+      if (entry.cr3_pfn == cr3_pfn)
+      {
+        entry.generation = 0;
+      }
     }
+  }
 
-    return pa_t::from_pfn(pte.page_frame_number)
-         + byte_offset(va.value());
+  bool memory_translator::cache_persistent() const noexcept
+  {
+    return cache_persistent_;
+  }
+
+  void memory_translator::cache_persistent(bool persistent) noexcept
+  {
+    cache_persistent_ = persistent;
+  }
+
+  auto memory_translator::hit_count() const noexcept -> uint64_t
+  {
+    return hit_count_;
+  }
+
+  auto memory_translator::miss_count() const noexcept -> uint64_t
+  {
+    return miss_count_;
   }
 
   va_t memory_translator::read_write(va_t va, cr3_t cr3, void* buffer, size_t size, bool write, bool ignore_errors) noexcept
@@ -132,10 +343,18 @@ namespace mm
     // invalid virtual address (accessing it would trigger page
     // fault).
     //
+    // Translation is performed once for each leaf page - if the
+    // virtual address is backed by a large page (2MB or 1GB), the
+    // whole part of the buffer which lies in that page is copied
+    // at once (the memory mapper maps as many pages as it can).
+    //
     while (size != 0)
     {
-      auto pa = va_to_pa(va, cr3);
-      auto bytes_to_copy = page_size - byte_offset(pa.value());
+      const auto translation = translate(va, cr3);
+      const auto pa = translation.pa;
+      const auto leaf_size = translation.size ? translation.size : page_size;
+
+      auto bytes_to_copy = leaf_size - (va.value() & (leaf_size - 1));
 
       if (bytes_to_copy > size)
       {
@@ -180,4 +399,132 @@ namespace mm
 
     return {};
   }
+
+  void memory_translator::read_batch_chunks(batch_entry_t* entry_list, batch_chunk_t* chunk_list, size_t chunk_count, cr3_t cr3, bool ignore_errors) noexcept
+  {
+    //
+    // Sort chunks by page, so that chunks of the same page are
+    // adjacent.  Chunks of a single request lie in distinct pages,
+    // therefore the first failed chunk of a request (in this order)
+    // is also its lowest invalid address.
+    //
+    // Note that std::stable_sort() isn't used, because it might
+    // allocate memory.
+    //
+    std::sort(chunk_list, chunk_list + chunk_count,
+      [](const batch_chunk_t& lhs, const batch_chunk_t& rhs) {
+        return lhs.page < rhs.page;
+      });
+
+    size_t chunk_index = 0;
+
+    while (chunk_index < chunk_count)
+    {
+      //
+      // Translate as many distinct pages as the mapper can map
+      // at once.
+      //
+      pa_t   pa_list[memory_mapper::max_slot_count];
+      void*  va_list[memory_mapper::max_slot_count];
+      size_t chunk_first[memory_mapper::max_slot_count + 1];
+      size_t page_count = 0;
+
+      while (chunk_index < chunk_count && page_count < mapper_.slot_count())
+      {
+        const auto page = chunk_list[chunk_index].page;
+        const auto pa = va_to_pa(va_t{ page }, cr3);
+
+        auto chunk_end = chunk_index;
+        while (chunk_end < chunk_count && chunk_list[chunk_end].page == page)
+        {
+          chunk_end += 1;
+        }
+
+        if (pa)
+        {
+          pa_list[page_count] = pa;
+          chunk_first[page_count] = chunk_index;
+          page_count += 1;
+        }
+        else
+        {
+          //
+          // Page is not present.
+          //
+          for (auto i = chunk_index; i < chunk_end; ++i)
+          {
+            const auto& chunk = chunk_list[i];
+            auto& entry = entry_list[chunk.entry_index];
+
+            if (!entry.result)
+            {
+              entry.result = page + chunk.page_offset;
+            }
+
+            if (ignore_errors)
+            {
+              memset(reinterpret_cast<uint8_t*>(entry.buffer) + chunk.buffer_offset, 0, chunk.size);
+            }
+          }
+        }
+
+        chunk_index = chunk_end;
+      }
+
+      chunk_first[page_count] = chunk_index;
+
+      //
+      // Map all pages at once and copy.
+      //
+      // Note that the chunk_first[] isn't contiguous if there was
+      // a not-present page - skip its chunks.
+      //
+      mapper_.map(pa_list, va_list, page_count);
+
+      for (size_t page_index = 0; page_index < page_count; ++page_index)
+      {
+        const auto page = chunk_list[chunk_first[page_index]].page;
+
+        for (auto i = chunk_first[page_index];
+             i < chunk_first[page_index + 1] && chunk_list[i].page == page;
+             ++i)
+        {
+          const auto& chunk = chunk_list[i];
+          const auto& entry = entry_list[chunk.entry_index];
+
+          memcpy(reinterpret_cast<uint8_t*>(entry.buffer) + chunk.buffer_offset,
+                 reinterpret_cast<uint8_t*>(va_list[page_index]) + chunk.page_offset,
+                 chunk.size);
+        }
+      }
+    }
+  }
+
+  template <size_t SIZE>
+  auto memory_translator::cache_lookup(cache_entry_t (&cache)[SIZE], uint64_t tag, uint64_t cr3_pfn) const noexcept -> const cache_entry_t*
+  {
+    //
+    // Direct-mapped cache.
+    //
+    const auto& entry = cache[tag % SIZE];
+
+    return (entry.generation == generation_ && entry.tag == tag && entry.cr3_pfn == cr3_pfn)
+      ? &entry
+      : nullptr;
+  }
+
+  template <size_t SIZE>
+  void memory_translator::cache_insert(cache_entry_t (&cache)[SIZE], uint64_t tag, uint64_t cr3_pfn, uint64_t pfn, const translation_t& translation) noexcept
+  {
+    auto& entry = cache[tag % SIZE];
+
+    entry.tag        = tag;
+    entry.cr3_pfn    = cr3_pfn;
+    entry.pfn        = pfn;
+    entry.generation = generation_;
+    entry.size       = translation.size;
+    entry.write      = translation.write;
+    entry.user       = translation.user;
+    entry.execute    = translation.execute;
+  }
 }
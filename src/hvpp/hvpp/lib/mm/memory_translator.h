@@ -10,10 +10,60 @@ namespace mm
   //
   // Class for reading/writing process virtual memory.
   //
+  // Translations made by va_to_pa(va, cr3) are cached in a small
+  // software TLB (keyed by CR3 PFN and virtual page) and PDE cache
+  // (keyed by CR3 PFN and 2MB region, holding PFN of the page table),
+  // so that repeated accesses to the same pages don't have to walk
+  // the guest page-tables again.
+  //
+  // Guest can change its page-tables at any time and it is required
+  // to flush only its own (hardware) TLB afterwards - which doesn't
+  // necessarily cause VM-exit.  Therefore, by default, cached
+  // translations are valid only during single VM-exit (vcpu_t calls
+  // flush() on each VM-exit).  If the VM-exit handler intercepts all
+  // instructions which invalidate TLB (MOV to CR3, MOV to CR4, INVLPG,
+  // INVPCID) and calls flush() accordingly (as vmexit_passthrough_handler
+  // does), the cache can be made persistent across VM-exits by
+  // cache_persistent(true).
+  //
 
   class memory_translator
   {
     public:
+      //
+      // Single read request of read_batch().
+      //
+      // "result" is set to the first invalid virtual address of the
+      // range, or to 0 if the whole range has been read.  Unlike
+      // read(), the "result" is set even if "ignore_errors" is true
+      // (the unreadable part of the buffer is zero-filled then).
+      //
+      struct batch_entry_t
+      {
+        va_t   va;
+        void*  buffer;
+        size_t size;
+        va_t   result;
+      };
+
+      //
+      // Result of translate().
+      //
+      // "pa" is 0 if the virtual address is not present.  "size" is
+      // the size of the leaf page (4kb, 2MB or 1GB) and access rights
+      // are combined from all levels of the paging hierarchy.  Note
+      // that CR0.WP, CR4.SMEP/SMAP and protection keys are not taken
+      // into account.
+      //
+      struct translation_t
+      {
+        pa_t     pa;
+        uint64_t size;
+        bool     write;
+        bool     user;
+        bool     execute;
+      };
+
       memory_translator() noexcept;
       ~memory_translator() noexcept;
 
@@ -25,12 +75,96 @@ namespace mm
       pa_t va_to_pa(va_t va) noexcept;
       pa_t va_to_pa(va_t va, cr3_t cr3) noexcept;
 
+      auto translate(va_t va, cr3_t cr3) noexcept -> translation_t;
+
       va_t read(va_t va, cr3_t cr3, void* buffer, size_t size, bool ignore_errors = false) noexcept;
       va_t write(va_t va, cr3_t cr3, const void* buffer, size_t size, bool ignore_errors = false) noexcept;
 
+      //
+      // Perform multiple (possibly overlapping) reads at once.
+      //
+      // Requests are split into per-page chunks, which are sorted by
+      // page - each distinct page is translated and mapped only once.
+      // Returns number of requests which couldn't be read completely.
+      //
+      size_t read_batch(batch_entry_t* entry_list, size_t count, cr3_t cr3, bool ignore_errors = false) noexcept;
+
+      //
+      // Invalidate all cached translations.
+      //
+      void flush() noexcept;
+
+      //
+      // Invalidate cached translations of the page containing "va"
+      // (in all address spaces) and the whole PDE cache - similarly
+      // to the INVLPG instruction.
+      //
+      void flush(va_t va) noexcept;
+
+      //
+      // Invalidate cached translations of the address space.
+      //
+      void flush(cr3_t cr3) noexcept;
+
+      bool cache_persistent() const noexcept;
+      void cache_persistent(bool persistent) noexcept;
+
+      auto hit_count() const noexcept -> uint64_t;
+      auto miss_count() const noexcept -> uint64_t;
+
     private:
+      static constexpr size_t tlb_size        = 64;
+      static constexpr size_t pde_cache_size  = 16;
+      static constexpr size_t batch_chunk_max = 64;
+
+      struct batch_chunk_t
+      {
+        uint64_t page;
+        uint32_t entry_index;
+        uint32_t page_offset;
+        uint32_t size;
+        size_t   buffer_offset;
+      };
+
+      struct cache_entry_t
+      {
+        uint64_t tag;         // va >> shift
+        uint64_t cr3_pfn;
+        uint64_t pfn;
+        uint64_t generation;
+
+        //
+        // Leaf page size and access rights (TLB), or access rights
+        // combined from PML4E, PDPTE and PDE (PDE cache).
+        //
+        uint64_t size;
+        bool     write;
+        bool     user;
+        bool     execute;
+      };
+
       va_t read_write(va_t va, cr3_t cr3, void* buffer, size_t size, bool write, bool ignore_errors) noexcept;
+      void read_batch_chunks(batch_entry_t* entry_list, batch_chunk_t* chunk_list, size_t chunk_count, cr3_t cr3, bool ignore_errors) noexcept;
+
+      template <size_t SIZE>
+      auto cache_lookup(cache_entry_t (&cache)[SIZE], uint64_t tag, uint64_t cr3_pfn) const noexcept -> const cache_entry_t*;
+
+      template <size_t SIZE>
+      void cache_insert(cache_entry_t (&cache)[SIZE], uint64_t tag, uint64_t cr3_pfn, uint64_t pfn, const translation_t& translation) noexcept;
 
       memory_mapper mapper_;
+
+      cache_entry_t tlb_[tlb_size];
+      cache_entry_t pde_cache_[pde_cache_size];
+
+      //
+      // Entries with different generation are invalid.  This makes
+      // flush() (which is called on each VM-exit) cheap.
+      //
+      uint64_t      generation_;
+      bool          cache_persistent_;
+
+      uint64_t      hit_count_;
+      uint64_t      miss_count_;
   };
 }
@@ -8,6 +8,14 @@
 #include <cstdint>
 #include <cinttypes>
 
+//
+// Dumps below are logged by the "mm" module, regardless of the module
+// of the translation unit which includes this header.
+//
+#pragma push_macro("HVPP_LOG_MODULE")
+#undef  HVPP_LOG_MODULE
+#define HVPP_LOG_MODULE mm
+
 namespace mm
 {
   using namespace ia32;
@@ -209,3 +217,5 @@ namespace mm
       int variable_count_ = 0;
   };
 }
+
+#pragma pop_macro("HVPP_LOG_MODULE")
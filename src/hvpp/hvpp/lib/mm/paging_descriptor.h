@@ -5,6 +5,14 @@
 #include <cstdint>
 #include <cinttypes>
 
+//
+// Dumps below are logged by the "mm" module, regardless of the module
+// of the translation unit which includes this header.
+//
+#pragma push_macro("HVPP_LOG_MODULE")
+#undef  HVPP_LOG_MODULE
+#define HVPP_LOG_MODULE mm
+
 namespace mm
 {
   using namespace ia32;
@@ -34,10 +42,10 @@ namespace mm
       void dump() const noexcept
       {
         hvpp_info("Paging information");
-        hvpp_info("      PML4 base             - %016" PRIx64, pml4_base_);
-        hvpp_info("      PDPT base             - %016" PRIx64, pdpt_base_);
-        hvpp_info("        PD base             - %016" PRIx64, pd_base_);
-        hvpp_info("        PT base             - %016" PRIx64, pt_base_);
+        hvpp_info("      PML4 base             - %016" PRIx64, reinterpret_cast<uint64_t>(pml4_base_));
+        hvpp_info("      PDPT base             - %016" PRIx64, reinterpret_cast<uint64_t>(pdpt_base_));
+        hvpp_info("        PD base             - %016" PRIx64, reinterpret_cast<uint64_t>(pd_base_));
+        hvpp_info("        PT base             - %016" PRIx64, reinterpret_cast<uint64_t>(pt_base_));
         hvpp_info("");
         hvpp_info("     System CR3             - %016" PRIx64, system_cr3_.flags);
       }
@@ -62,3 +70,5 @@ namespace mm
       cr3_t system_cr3_;
   };
 }
+
+#pragma pop_macro("HVPP_LOG_MODULE")
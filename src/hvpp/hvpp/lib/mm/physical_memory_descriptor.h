@@ -2,6 +2,14 @@
 #include "hvpp/ia32/memory.h"
 #include "../log.h"
 
+//
+// Dumps below are logged by the "mm" module, regardless of the module
+// of the translation unit which includes this header.
+//
+#pragma push_macro("HVPP_LOG_MODULE")
+#undef  HVPP_LOG_MODULE
+#define HVPP_LOG_MODULE mm
+
 namespace mm
 {
   using namespace ia32;
@@ -60,3 +68,5 @@ namespace mm
       int                   count_ = 0;
   };
 }
+
+#pragma pop_macro("HVPP_LOG_MODULE")
@@ -1,3 +1,5 @@
+#define HVPP_LOG_MODULE mm
+
 #include <ntddk.h>
 
 #define HVPP_MAPPING_TAG 'mpvh'
@@ -1,3 +1,5 @@
+#define HVPP_LOG_MODULE mm
+
 #include "hvpp/ia32/memory.h"
 
 #include <ntddk.h>
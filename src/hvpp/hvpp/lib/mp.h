@@ -10,17 +10,38 @@ namespace mp
   namespace detail
   {
     uint32_t cpu_count() noexcept;
+    uint32_t cpu_active_count() noexcept;
     uint32_t cpu_index() noexcept;
+    bool     cpu_is_active(uint32_t cpu_index) noexcept;
     void     sleep(uint32_t milliseconds) noexcept;
     void     ipi_call(void(*callback)(void*), void* context) noexcept;
   }
 
+  //
+  // Maximum number of CPUs (in all processor groups) and system-wide
+  // index of the current CPU - in range [0, cpu_count()).  There is
+  // no static limit of the number of CPUs - all per-CPU storage is
+  // sized by cpu_count() at initialization.
+  //
+  // Note that cpu_count() includes CPUs which aren't active (e.g.
+  // CPUs which can be hot-added later, or CPUs excluded by the boot
+  // configuration) - the index of an active CPU might be greater than
+  // cpu_active_count().  Code iterating over all CPUs should skip
+  // those for which cpu_is_active() returns false.
+  //
+
   inline uint32_t cpu_count() noexcept
   { return detail::cpu_count(); }
 
+  inline uint32_t cpu_active_count() noexcept
+  { return detail::cpu_active_count(); }
+
   inline uint32_t cpu_index() noexcept
   { return detail::cpu_index(); }
 
+  inline bool cpu_is_active(uint32_t cpu_index) noexcept
+  { return detail::cpu_is_active(cpu_index); }
+
   inline void sleep(uint32_t milliseconds) noexcept
   { detail::sleep(milliseconds); }
 
@@ -0,0 +1,133 @@
+#pragma once
+#include <atomic>       // std::atomic
+#include <cstddef>      // size_t
+#include <cstdint>
+#include <type_traits>  // std::is_trivially_copyable_v
+
+//
+// Bounded lock-free multi-producer single-consumer queue.
+//
+// Each slot holds a sequence number, which tells whose turn it is:
+//   - sequence == position       ... slot is free for the producer
+//                                    at this position
+//   - sequence == position + 1   ... slot holds the item at this position
+//                                    (published by the producer)
+//
+// Producers reserve a position by compare-exchange on "head", write
+// the item and publish it by storing the sequence number.  The consumer
+// then frees the slot for the producer one lap ahead.  Producers never
+// wait for each other or for the consumer - push() fails if the queue
+// is full.  Therefore, items can be pushed from any context (including
+// VMX-root mode or interrupted producer on the same CPU).
+//
+// Only one consumer may call pop() at a time.
+//
+
+template <
+  typename T,
+  size_t Size
+>
+class mpsc_queue
+{
+  public:
+    static_assert(Size && (Size & (Size - 1)) == 0, "Size must be power of 2");
+    static_assert(std::is_trivially_copyable_v<T>);
+
+    mpsc_queue() noexcept
+      : head_{ 0 }
+      , tail_{ 0 }
+    {
+      for (size_t i = 0; i < Size; ++i)
+      {
+        slot_[i].sequence.store(i, std::memory_order_relaxed);
+      }
+    }
+
+    mpsc_queue(const mpsc_queue& other) noexcept = delete;
+    mpsc_queue(mpsc_queue&& other) noexcept = delete;
+    mpsc_queue& operator=(const mpsc_queue& other) noexcept = delete;
+    mpsc_queue& operator=(mpsc_queue&& other) noexcept = delete;
+    ~mpsc_queue() noexcept = default;
+
+    bool push(const T& item) noexcept
+    {
+      auto position = head_.load(std::memory_order_relaxed);
+
+      for (;;)
+      {
+        auto& slot = slot_[position & (Size - 1)];
+
+        const auto sequence = slot.sequence.load(std::memory_order_acquire);
+        const auto distance = static_cast<int64_t>(sequence - position);
+
+        if (distance == 0)
+        {
+          //
+          // Slot is free - try to reserve it.
+          //
+          if (head_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+          {
+            slot.item = item;
+            slot.sequence.store(position + 1, std::memory_order_release);
+            return true;
+          }
+        }
+        else if (distance < 0)
+        {
+          //
+          // Slot still holds the item from the previous lap - the queue
+          // is full.
+          //
+          return false;
+        }
+        else
+        {
+          //
+          // Other producer has reserved this position in the meantime.
+          //
+          position = head_.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    bool pop(T& item) noexcept
+    {
+      const auto position = tail_.load(std::memory_order_relaxed);
+      auto& slot = slot_[position & (Size - 1)];
+
+      if (slot.sequence.load(std::memory_order_acquire) != position + 1)
+      {
+        return false;
+      }
+
+      item = slot.item;
+
+      //
+      // Free the slot for the producer one lap ahead.
+      //
+      slot.sequence.store(position + Size, std::memory_order_release);
+      tail_.store(position + 1, std::memory_order_relaxed);
+      return true;
+    }
+
+    bool empty() const noexcept
+    {
+      const auto position = tail_.load(std::memory_order_relaxed);
+      return slot_[position & (Size - 1)].sequence.load(std::memory_order_acquire) != position + 1;
+    }
+
+  private:
+    struct slot_t
+    {
+      std::atomic<uint64_t> sequence;
+      T                     item;
+    };
+
+    //
+    // Written by producers / by the consumer - keep them on separate
+    // cache lines.
+    //
+    alignas(64) std::atomic<uint64_t> head_;
+    alignas(64) std::atomic<uint64_t> tail_;
+    alignas(64) slot_t                slot_[Size];
+};
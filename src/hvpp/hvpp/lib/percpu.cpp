@@ -0,0 +1,92 @@
+#include "percpu.h"
+
+#include "assert.h"
+#include "spinlock.h"
+
+#include <cstring>
+#include <mutex>
+
+namespace percpu
+{
+  namespace
+  {
+    uint32_t block_count_;
+    size_t   reserved_size_;
+
+    //
+    // Serializes reservations.  Note that spinlock is constant-initialized,
+    // therefore it can be a global variable.
+    //
+    spinlock reserve_lock_;
+  }
+
+  auto initialize() noexcept -> error_code_t
+  {
+    hvpp_assert(!detail::block_base);
+
+    const auto block_count = mp::cpu_count();
+    const auto block_base  = reinterpret_cast<uint8_t*>(detail::allocate(block_count * block_size));
+
+    if (!block_base)
+    {
+      return make_error_code_t(std::errc::not_enough_memory);
+    }
+
+    memset(block_base, 0, block_count * block_size);
+
+    detail::block_base = block_base;
+    block_count_       = block_count;
+    reserved_size_     = 0;
+
+    return {};
+  }
+
+  void destroy() noexcept
+  {
+    if (!detail::block_base)
+    {
+      return;
+    }
+
+    detail::free(detail::block_base);
+
+    detail::block_base = nullptr;
+    block_count_       = 0;
+    reserved_size_     = 0;
+  }
+
+  auto reserve(size_t size, size_t alignment, uint32_t& offset) noexcept -> error_code_t
+  {
+    hvpp_assert(detail::block_base);
+    hvpp_assert(alignment && (alignment & (alignment - 1)) == 0);
+
+    std::lock_guard _{ reserve_lock_ };
+
+    if (offset != invalid_offset)
+    {
+      return {};
+    }
+
+    if (!detail::block_base)
+    {
+      return make_error_code_t(std::errc::not_connected);
+    }
+
+    const auto aligned_offset = (reserved_size_ + alignment - 1) & ~(alignment - 1);
+
+    if (aligned_offset + size > block_size)
+    {
+      return make_error_code_t(std::errc::not_enough_memory);
+    }
+
+    for (uint32_t cpu_index = 0; cpu_index < block_count_; ++cpu_index)
+    {
+      memset(reinterpret_cast<uint8_t*>(block(cpu_index)) + aligned_offset, 0, size);
+    }
+
+    offset         = static_cast<uint32_t>(aligned_offset);
+    reserved_size_ = aligned_offset + size;
+
+    return {};
+  }
+}
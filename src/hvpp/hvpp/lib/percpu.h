@@ -0,0 +1,109 @@
+#pragma once
+#include "error.h"
+#include "mp.h"
+
+#include <cstdint>
+#include <type_traits>
+
+//
+// Per-CPU data.
+//
+// Each CPU has its own block of "block_size" bytes.  Blocks are
+// page-aligned and adjacent (single non-paged allocation), therefore
+// data of different CPUs never share a cache line.  Subsystems reserve
+// their (typed) slots in the block - each slot has the same offset
+// in the block of each CPU.
+//
+// Block of the current CPU is found in O(1) - it's simply at
+// "base + cpu_index * block_size".  mp::cpu_index() reads the number
+// of the CPU from the processor control region (via GS), which works
+// in VMX root mode as well (HOST_GS_BASE is the kernel GS base).
+//
+// Slots are reserved by slot_t::initialize() - typically at startup
+// (e.g. in vmexit_handler::setup()), before the slot is used for the
+// first time.  Reservations are serialized, therefore the same slot
+// can be initialized concurrently on all CPUs - only the first call
+// reserves it.  Reserved space isn't returned until percpu::destroy().
+// Slot memory is zeroed on reservation and no constructors/destructors
+// are called, therefore only trivial types can be stored in slots.
+//
+// Usage:
+//   static percpu::slot_t<uint64_t> counter;
+//
+//   counter.initialize();    // At startup.
+//   counter.get() += 1;      // Counter of the current CPU.
+//   counter.get(3);          // Counter of the CPU #3.
+//
+
+namespace percpu
+{
+  //
+  // Size of the block of each CPU.  Must be multiple of the page size.
+  //
+  static constexpr size_t block_size = 4 * 4096;
+
+  namespace detail
+  {
+    //
+    // Allocate/free "size" bytes of the non-paged, page-aligned memory.
+    //
+    auto allocate(size_t size) noexcept -> void*;
+    void free(void* address) noexcept;
+
+    inline uint8_t* block_base;
+  }
+
+  auto initialize() noexcept -> error_code_t;
+  void destroy() noexcept;
+
+  static constexpr uint32_t invalid_offset = ~uint32_t(0);
+
+  //
+  // Reserve "size" bytes (aligned to "alignment") in the block of each
+  // CPU and zero them.  Returns offset of the reserved space in "offset".
+  // Does nothing if the "offset" is already valid (i.e. it isn't
+  // invalid_offset).
+  //
+  auto reserve(size_t size, size_t alignment, uint32_t& offset) noexcept -> error_code_t;
+
+  inline auto block(uint32_t cpu_index) noexcept -> void*
+  { return detail::block_base + cpu_index * block_size; }
+
+  inline auto block() noexcept -> void*
+  { return block(mp::cpu_index()); }
+
+  template <typename T>
+  class slot_t
+  {
+    public:
+      static_assert(std::is_trivially_destructible_v<T>, "Per-CPU data must be trivially destructible");
+      static_assert(alignof(T) <= 4096, "Per-CPU data can't be aligned beyond the page size");
+      static_assert(sizeof(T) <= block_size, "Per-CPU data must fit into the per-CPU block");
+
+      //
+      // Reserve the slot.  Does nothing if the slot has been already
+      // reserved.
+      //
+      auto initialize() noexcept -> error_code_t
+      {
+        return is_initialized()
+          ? error_code_t{}
+          : reserve(sizeof(T), alignof(T), offset_);
+      }
+
+      bool is_initialized() const noexcept
+      { return offset_ != invalid_offset; }
+
+      T& get() noexcept
+      { return get(mp::cpu_index()); }
+
+      T& get(uint32_t cpu_index) noexcept
+      { return *reinterpret_cast<T*>(reinterpret_cast<uint8_t*>(block(cpu_index)) + offset_); }
+
+      const T& get(uint32_t cpu_index) const noexcept
+      { return *reinterpret_cast<const T*>(reinterpret_cast<const uint8_t*>(block(cpu_index)) + offset_); }
+
+    private:
+      uint32_t offset_ = invalid_offset;
+  };
+}
@@ -0,0 +1,177 @@
+#include "shared_ring.h"
+
+#include "assert.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+
+shared_ring::shared_ring() noexcept
+  : header_{}
+  , entry_{}
+  , data_{}
+  , size_{}
+  , slot_count_{}
+  , producer_index_{}
+  , mdl_{}
+  , user_address_{}
+  , user_process_{}
+  , lock_{ "shared_ring" }
+  , user_lock_{ "shared_ring::user" }
+{
+
+}
+
+shared_ring::~shared_ring() noexcept
+{
+  destroy();
+}
+
+auto shared_ring::create(size_t slot_count) noexcept -> error_code_t
+{
+  hvpp_assert(!header_);
+
+  if (slot_count == 0 ||
+      slot_count > max_slot_count ||
+      (slot_count & (slot_count - 1)) != 0)
+  {
+    return make_error_code_t(std::errc::invalid_argument);
+  }
+
+  //
+  // Header and entries are followed by page-aligned data slots.
+  //
+  const auto entry_offset = (sizeof(header_t) + alignof(entry_t) - 1) & ~(alignof(entry_t) - 1);
+  const auto data_offset  = ia32::page_align_up(entry_offset + slot_count * sizeof(entry_t));
+  const auto size         = data_offset + slot_count * slot_size;
+
+  void* mdl = nullptr;
+  const auto va = detail::shared_ring_allocate(size, mdl);
+
+  if (!va)
+  {
+    return make_error_code_t(std::errc::not_enough_memory);
+  }
+
+  memset(va, 0, size);
+
+  header_         = reinterpret_cast<header_t*>(va);
+  entry_          = reinterpret_cast<entry_t*>(reinterpret_cast<uint8_t*>(va) + entry_offset);
+  data_           = reinterpret_cast<uint8_t*>(va) + data_offset;
+  size_           = size;
+  slot_count_     = static_cast<uint32_t>(slot_count);
+  producer_index_ = 0;
+  mdl_            = mdl;
+
+  header_->slot_count   = static_cast<uint32_t>(slot_count);
+  header_->slot_size    = static_cast<uint32_t>(slot_size);
+  header_->entry_offset = static_cast<uint32_t>(entry_offset);
+  header_->data_offset  = static_cast<uint32_t>(data_offset);
+
+  return {};
+}
+
+void shared_ring::destroy() noexcept
+{
+  if (!header_)
+  {
+    return;
+  }
+
+  //
+  // The ring should be unmapped by now (from the context of the
+  // process which mapped it).
+  //
+  hvpp_assert(!user_address_);
+
+  detail::shared_ring_free(header_, mdl_);
+
+  header_         = nullptr;
+  entry_          = nullptr;
+  data_           = nullptr;
+  size_           = 0;
+  slot_count_     = 0;
+  producer_index_ = 0;
+  mdl_            = nullptr;
+}
+
+auto shared_ring::map_user(void*& user_address, size_t& size) noexcept -> error_code_t
+{
+  if (!header_)
+  {
+    return make_error_code_t(std::errc::not_connected);
+  }
+
+  std::lock_guard _{ user_lock_ };
+
+  if (user_address_)
+  {
+    return make_error_code_t(std::errc::device_or_resource_busy);
+  }
+
+  const auto va = detail::shared_ring_map_user(mdl_);
+
+  if (!va)
+  {
+    return make_error_code_t(std::errc::not_enough_memory);
+  }
+
+  user_address_ = va;
+  user_process_ = detail::shared_ring_current_process();
+
+  user_address = va;
+  size = size_;
+
+  return {};
+}
+
+auto shared_ring::unmap_user() noexcept -> error_code_t
+{
+  std::lock_guard _{ user_lock_ };
+
+  if (!user_address_)
+  {
+    return make_error_code_t(std::errc::not_connected);
+  }
+
+  if (user_process_ != detail::shared_ring_current_process())
+  {
+    return make_error_code_t(std::errc::permission_denied);
+  }
+
+  detail::shared_ring_unmap_user(user_address_, mdl_);
+  user_address_ = nullptr;
+  user_process_ = nullptr;
+
+  return {};
+}
+
+auto shared_ring::produce_physical(mm::memory_mapper& mapper, ia32::pa_t pa, size_t size, uint64_t tag) noexcept -> size_t
+{
+  size_t bytes_copied = 0;
+
+  while (size > 0)
+  {
+    //
+    // Don't cross the page boundary - each slot holds (part of)
+    // single physical page.
+    //
+    const auto bytes_to_copy = std::min<size_t>(size, ia32::page_size - ia32::byte_offset(pa.value()));
+
+    const auto produced = produce(tag, pa.value(), [&](void* slot, size_t, uint32_t&) {
+      mapper.read(pa, slot, bytes_to_copy);
+      return bytes_to_copy;
+    });
+
+    if (!produced)
+    {
+      break;
+    }
+
+    pa           += bytes_to_copy;
+    size         -= bytes_to_copy;
+    bytes_copied += bytes_to_copy;
+  }
+
+  return bytes_copied;
+}
@@ -0,0 +1,157 @@
+#pragma once
+#include "shared_ring_layout.h"
+#include "error.h"
+#include "spinlock_stats.h"
+#include "mm/memory_mapper.h"
+
+#include "hvpp/ia32/memory.h"
+
+#include <cstdint>
+#include <mutex>
+
+namespace detail
+{
+  void* shared_ring_allocate(size_t size, void*& mdl) noexcept;
+  void  shared_ring_free(void* va, void* mdl) noexcept;
+  void* shared_ring_map_user(void* mdl) noexcept;
+  void  shared_ring_unmap_user(void* user_va, void* mdl) noexcept;
+  void* shared_ring_current_process() noexcept;
+}
+
+//
+// Ring of page-sized buffers shared between the hypervisor and
+// a user-mode client (see shared_ring_layout.h for the layout and
+// the producer/consumer protocol).
+//
+// The ring is allocated from the non-paged memory, therefore it can
+// be filled from the VMX-root mode - data are copied straight from
+// the guest physical memory into the slot, which is the same memory
+// the client sees in its address space.  No intermediate buffer and
+// no copy on the ioctl path is involved.
+//
+// There is single producer (the hypervisor) - concurrent producers
+// (VCPUs) are serialized by the spinlock - and single consumer.
+//
+// Note that the header is writable by the client.  Therefore the
+// producer never trusts values stored in it (except the
+// "consumer_index", which is sanitized).
+//
+
+class shared_ring
+{
+  public:
+    using entry_t = shared_ring_entry_t;
+    using header_t = shared_ring_header_t;
+
+    static constexpr size_t slot_size      = ia32::page_size;
+    static constexpr size_t max_slot_count = 4096;
+
+    shared_ring() noexcept;
+    shared_ring(const shared_ring& other) noexcept = delete;
+    shared_ring(shared_ring&& other) noexcept = delete;
+    shared_ring& operator=(const shared_ring& other) noexcept = delete;
+    shared_ring& operator=(shared_ring&& other) noexcept = delete;
+    ~shared_ring() noexcept;
+
+    //
+    // Allocate the ring.  "slot_count" must be power of 2.
+    //
+    auto create(size_t slot_count) noexcept -> error_code_t;
+    void destroy() noexcept;
+
+    bool is_created() const noexcept
+    { return header_ != nullptr; }
+
+    //
+    // Map the ring into the address space of the current process.
+    // Only one mapping may exist at a time.
+    //
+    // Note that the mapping must be removed in the context of the
+    // same process (e.g. on cleanup of the device handle) - calling
+    // unmap_user() from other process fails.
+    //
+    auto map_user(void*& user_address, size_t& size) noexcept -> error_code_t;
+    auto unmap_user() noexcept -> error_code_t;
+
+    bool is_mapped_user() const noexcept
+    { return user_address_ != nullptr; }
+
+    //
+    // Reserve the next free slot and let "fill" write the data into
+    // it.  "fill" has signature:
+    //
+    //   size_t fill(void* slot, size_t slot_size, uint32_t& flags)
+    //
+    // and returns number of bytes written.  Returns false (and
+    // increments dropped count) if the ring is full.
+    //
+    template <typename TFill>
+    bool produce(uint64_t tag, uint64_t address, TFill&& fill) noexcept
+    {
+      if (!header_)
+      {
+        return false;
+      }
+
+      std::lock_guard _{ lock_ };
+
+      const auto producer_index = producer_index_;
+      const auto consumer_index = header_->consumer_index.load(std::memory_order_acquire);
+
+      //
+      // Consumer index is written by the client - make sure it
+      // isn't ahead of the producer.
+      //
+      if (static_cast<uint32_t>(producer_index - consumer_index) >= slot_count_)
+      {
+        header_->dropped_count.fetch_add(1, std::memory_order_relaxed);
+        return false;
+      }
+
+      const auto slot_index = producer_index & (slot_count_ - 1);
+
+      uint32_t flags = 0;
+      const auto size = fill(data_ + slot_index * slot_size, slot_size, flags);
+
+      auto& entry = entry_[slot_index];
+      entry.tag     = tag;
+      entry.address = address;
+      entry.size    = static_cast<uint32_t>(size < slot_size ? size : slot_size);
+      entry.flags   = flags;
+
+      producer_index_ = producer_index + 1;
+      header_->producer_index.store(producer_index_, std::memory_order_release);
+
+      return true;
+    }
+
+    //
+    // Copy physical memory [pa, pa + size) into the ring (one slot
+    // per page).  Returns number of bytes which have been copied.
+    //
+    auto produce_physical(mm::memory_mapper& mapper, ia32::pa_t pa, size_t size, uint64_t tag) noexcept -> size_t;
+
+    auto size() const noexcept -> size_t
+    { return size_; }
+
+    auto slot_count() const noexcept -> size_t
+    { return slot_count_; }
+
+    auto dropped_count() const noexcept -> uint32_t
+    { return header_ ? header_->dropped_count.load(std::memory_order_relaxed) : 0; }
+
+  private:
+    header_t* header_;
+    entry_t*  entry_;
+    uint8_t*  data_;
+    size_t    size_;
+    uint32_t  slot_count_;
+    uint32_t  producer_index_;
+
+    void*     mdl_;
+    void*     user_address_;
+    void*     user_process_;
+
+    instrumented_lock<spinlock> lock_;      // Serializes producers.
+    instrumented_lock<spinlock> user_lock_; // Serializes map_user()/unmap_user().
+};
@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdint>
+#include <atomic>
+
+//
+// Layout of the ring buffer shared between the hypervisor (producer)
+// and user-mode client (consumer).  This header has no dependencies,
+// so that it can be included by user-mode clients as well.
+//
+// The shared memory consists of:
+//   - shared_ring_header_t (at offset 0)
+//   - array of "slot_count" shared_ring_entry_t (at "entry_offset")
+//   - array of "slot_count" data slots, each "slot_size" bytes large
+//     (at "data_offset")
+//
+// Protocol:
+//   - "producer_index" and "consumer_index" are free-running counters
+//     (they're never wrapped to "slot_count").  Slot of the index "i"
+//     is "i % slot_count" ("slot_count" is power of 2).
+//   - The ring is empty if "producer_index == consumer_index" and it's
+//     full if "producer_index - consumer_index == slot_count".
+//   - Producer fills the data slot and its entry and then increments
+//     "producer_index" (release).  If the ring is full, the data are
+//     dropped and "dropped_count" is incremented.
+//   - Consumer reads "producer_index" (acquire), processes all slots
+//     up to that index and then sets "consumer_index" (release).
+//     Slots below "consumer_index" are reused by the producer.
+//
+// Producer and consumer indices are placed in separate cache lines.
+//
+
+struct shared_ring_entry_t
+{
+  static constexpr uint32_t flag_incomplete = 1 << 0;
+
+  uint64_t tag;       // Provided by the producer.
+  uint64_t address;   // Source address of the data (physical or virtual).
+  uint32_t size;      // Number of valid bytes in the data slot.
+  uint32_t flags;
+};
+
+struct shared_ring_header_t
+{
+  uint32_t slot_count;
+  uint32_t slot_size;
+  uint32_t entry_offset;
+  uint32_t data_offset;
+
+  //
+  // Written by the producer.
+  //
+  alignas(64) std::atomic<uint32_t> producer_index;
+  std::atomic<uint32_t>             dropped_count;
+
+  //
+  // Written by the consumer.
+  //
+  alignas(64) std::atomic<uint32_t> consumer_index;
+};
+
+static_assert(sizeof(shared_ring_entry_t) == 24);
+static_assert(std::atomic<uint32_t>::is_always_lock_free);
@@ -63,3 +63,332 @@ class spinlock
   private:
     std::atomic_flag lock_ = ATOMIC_FLAG_INIT;
 };
+
+//
+// Ticket spinlock.
+//
+// Unlike the spinlock above, this lock is fair - CPUs acquire it
+// in the order in which they started waiting for it, therefore no CPU
+// can be starved by the others.  All waiters still spin on the same
+// cache line, though.
+//
+// The wait between two reads of the "owner" is proportional to the
+// number of CPUs in the queue before us.
+//
+
+class ticket_spinlock
+{
+  public:
+    bool try_lock() noexcept
+    {
+      auto owner = owner_.load(std::memory_order_relaxed);
+
+      //
+      // Take the ticket only if it's our turn right away.
+      //
+      return next_.compare_exchange_strong(owner, owner + 1,
+                                           std::memory_order_acquire,
+                                           std::memory_order_relaxed);
+    }
+
+    void lock() noexcept
+    {
+      const auto ticket = next_.fetch_add(1, std::memory_order_relaxed);
+
+      for (;;)
+      {
+        const auto owner = owner_.load(std::memory_order_acquire);
+
+        if (owner == ticket)
+        {
+          break;
+        }
+
+        for (unsigned i = 0; i < ticket - owner; ++i)
+        {
+          ia32_asm_pause();
+        }
+      }
+    }
+
+    void unlock() noexcept
+    {
+      //
+      // Only the owner writes the "owner" field.
+      //
+      owner_.store(owner_.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_release);
+    }
+
+  private:
+    std::atomic<uint32_t> next_  = { 0 };
+    std::atomic<uint32_t> owner_ = { 0 };
+};
+
+//
+// MCS (queued) spinlock.
+//
+// Fair as well - and each waiter spins on its own queue node, so that
+// the cache line of the lock isn't bounced between waiting CPUs.  This
+// is the "K42" variant of the MCS lock: the queue node lives on the stack
+// of the waiter only while it waits.  The owner doesn't need any node,
+// therefore the lock keeps the standard lock()/unlock()/try_lock()
+// interface (and can be used with std::lock_guard or with
+// vcpu_t::stacked_lock_guard).
+//
+// The lock itself is a node as well:
+//   - "tail_.tail" points to the last waiter in the queue (or to the
+//     lock itself, if it's locked and nobody waits, or nullptr, if it's
+//     unlocked).
+//   - "tail_.next" points to the first waiter (the successor of the
+//     current owner).
+//
+
+class mcs_spinlock
+{
+  public:
+    bool try_lock() noexcept
+    {
+      node_t* expected = nullptr;
+
+      return tail_.tail.compare_exchange_strong(expected, &tail_,
+                                                std::memory_order_acquire,
+                                                std::memory_order_relaxed);
+    }
+
+    void lock() noexcept
+    {
+      for (;;)
+      {
+        auto prev = tail_.tail.load(std::memory_order_relaxed);
+
+        if (!prev)
+        {
+          //
+          // Lock appears to be free.
+          //
+          if (tail_.tail.compare_exchange_strong(prev, &tail_,
+                                                 std::memory_order_acquire,
+                                                 std::memory_order_relaxed))
+          {
+            return;
+          }
+        }
+        else
+        {
+          node_t node;
+          node.tail.store(waiting(), std::memory_order_relaxed);
+          node.next.store(nullptr, std::memory_order_relaxed);
+
+          if (tail_.tail.compare_exchange_strong(prev, &node,
+                                                 std::memory_order_acq_rel,
+                                                 std::memory_order_relaxed))
+          {
+            //
+            // We're in the queue.  Link ourselves to the predecessor
+            // and wait until it hands the lock over to us.
+            //
+            prev->next.store(&node, std::memory_order_release);
+
+            while (node.tail.load(std::memory_order_acquire) == waiting())
+            {
+              ia32_asm_pause();
+            }
+
+            //
+            // We own the lock now, but our node is about to go out
+            // of scope - move our successor (if any) to the lock.
+            //
+            auto succ = node.next.load(std::memory_order_acquire);
+
+            if (!succ)
+            {
+              tail_.next.store(nullptr, std::memory_order_relaxed);
+
+              auto expected = &node;
+              if (!tail_.tail.compare_exchange_strong(expected, &tail_,
+                                                      std::memory_order_acq_rel,
+                                                      std::memory_order_relaxed))
+              {
+                //
+                // Someone enqueued behind us in the meantime - wait
+                // until it links itself to our node.
+                //
+                while (!(succ = node.next.load(std::memory_order_acquire)))
+                {
+                  ia32_asm_pause();
+                }
+
+                tail_.next.store(succ, std::memory_order_relaxed);
+              }
+            }
+            else
+            {
+              tail_.next.store(succ, std::memory_order_relaxed);
+            }
+
+            return;
+          }
+        }
+
+        ia32_asm_pause();
+      }
+    }
+
+    void unlock() noexcept
+    {
+      auto succ = tail_.next.load(std::memory_order_acquire);
+
+      if (!succ)
+      {
+        auto expected = &tail_;
+        if (tail_.tail.compare_exchange_strong(expected, nullptr,
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed))
+        {
+          //
+          // Nobody waits.
+          //
+          return;
+        }
+
+        //
+        // Someone is enqueueing - wait until it links itself.
+        //
+        while (!(succ = tail_.next.load(std::memory_order_acquire)))
+        {
+          ia32_asm_pause();
+        }
+      }
+
+      //
+      // Hand the lock over.
+      //
+      succ->tail.store(nullptr, std::memory_order_release);
+    }
+
+  private:
+    struct node_t
+    {
+      std::atomic<node_t*> tail = { nullptr };
+      std::atomic<node_t*> next = { nullptr };
+    };
+
+    static node_t* waiting() noexcept
+    {
+      return reinterpret_cast<node_t*>(1);
+    }
+
+    node_t tail_;
+};
+
+//
+// Reader-writer spinlock.
+//
+// Meant for read-mostly structures (e.g. shared EPT or hook tables),
+// where many CPUs can look up entries concurrently while updates are
+// rare.  Besides lock()/unlock()/try_lock() (exclusive access), it has
+// lock_shared()/unlock_shared()/try_lock_shared(), so it can be used
+// with std::shared_lock or with vcpu_t::stacked_shared_lock_guard.
+//
+// The lock is writer-preferring: once a writer starts waiting, new
+// readers wait as well, therefore writers can't be starved by
+// a continuous stream of readers.
+//
+// Layout of the state:
+//   - bit 0 ... writer holds the lock
+//   - bit 1 ... writer waits for the lock
+//   - bits 2+ . number of readers holding the lock
+//
+
+class rw_spinlock
+{
+  public:
+    static constexpr unsigned max_wait = spinlock::max_wait;
+
+    bool try_lock() noexcept
+    {
+      auto state = state_.load(std::memory_order_relaxed);
+
+      return (state & ~writer_waiting) == 0
+          && state_.compare_exchange_strong(state, writer_locked,
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed);
+    }
+
+    void lock() noexcept
+    {
+      unsigned wait = 1;
+
+      while (!try_lock())
+      {
+        //
+        // Stop new readers from entering.
+        //
+        if (!(state_.load(std::memory_order_relaxed) & writer_waiting))
+        {
+          state_.fetch_or(writer_waiting, std::memory_order_relaxed);
+        }
+
+        for (unsigned i = 0; i < wait; ++i)
+        {
+          ia32_asm_pause();
+        }
+
+        wait = std::min(wait * 2, max_wait);
+      }
+    }
+
+    void unlock() noexcept
+    {
+      //
+      // Keep the "writer_waiting" bit - other writers might be
+      // waiting as well.
+      //
+      state_.fetch_and(~writer_locked, std::memory_order_release);
+    }
+
+    bool try_lock_shared() noexcept
+    {
+      auto state = state_.load(std::memory_order_relaxed);
+
+      while (!(state & (writer_locked | writer_waiting)))
+      {
+        if (state_.compare_exchange_weak(state, state + reader,
+                                         std::memory_order_acquire,
+                                         std::memory_order_relaxed))
+        {
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    void lock_shared() noexcept
+    {
+      unsigned wait = 1;
+
+      while (!try_lock_shared())
+      {
+        for (unsigned i = 0; i < wait; ++i)
+        {
+          ia32_asm_pause();
+        }
+
+        wait = std::min(wait * 2, max_wait);
+      }
+    }
+
+    void unlock_shared() noexcept
+    {
+      state_.fetch_sub(reader, std::memory_order_release);
+    }
+
+  private:
+    static constexpr uint32_t writer_locked  = 1 << 0;
+    static constexpr uint32_t writer_waiting = 1 << 1;
+    static constexpr uint32_t reader         = 1 << 2;
+
+    std::atomic<uint32_t> state_ = { 0 };
+};
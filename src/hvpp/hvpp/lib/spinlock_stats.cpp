@@ -0,0 +1,103 @@
+#include "spinlock_stats.h"
+
+#include "log.h"
+
+#include <cinttypes>
+#include <cstring>
+#include <mutex>
+
+namespace spinlock_stats
+{
+  namespace
+  {
+    //
+    // List of registered locks.  The registry lock is a plain
+    // (constant-initialized) spinlock.
+    //
+    counters_t* registry_head_;
+    spinlock    registry_lock_;
+  }
+
+  namespace detail
+  {
+    void attach(counters_t& counters) noexcept
+    {
+      std::lock_guard _{ registry_lock_ };
+
+      counters.next  = registry_head_;
+      registry_head_ = &counters;
+    }
+
+    void detach(counters_t& counters) noexcept
+    {
+      std::lock_guard _{ registry_lock_ };
+
+      for (auto link = &registry_head_; *link; link = &(*link)->next)
+      {
+        if (*link == &counters)
+        {
+          *link = counters.next;
+          break;
+        }
+      }
+    }
+  }
+
+  void snapshot(snapshot_t& result) noexcept
+  {
+    std::lock_guard _{ registry_lock_ };
+
+    memset(&result, 0, sizeof(result));
+
+    for (auto counters = registry_head_; counters; counters = counters->next)
+    {
+      if (result.entry_count == max_entry_count)
+      {
+        result.missing_count += 1;
+        continue;
+      }
+
+      auto& entry = result.entry[result.entry_count++];
+
+      strncpy(entry.name, counters->name, max_name_length - 1);
+      entry.acquire_count   = counters->acquire_count.load(std::memory_order_relaxed);
+      entry.contended_count = counters->contended_count.load(std::memory_order_relaxed);
+      entry.wait_cycles     = counters->wait_cycles.load(std::memory_order_relaxed);
+      entry.max_wait_cycles = counters->max_wait_cycles.load(std::memory_order_relaxed);
+    }
+  }
+
+  void dump() noexcept
+  {
+    std::lock_guard _{ registry_lock_ };
+
+    if (!registry_head_)
+    {
+      return;
+    }
+
+    hvpp_info("Spinlock statistics");
+
+    for (auto counters = registry_head_; counters; counters = counters->next)
+    {
+      const auto acquire_count   = counters->acquire_count.load(std::memory_order_relaxed);
+      const auto contended_count = counters->contended_count.load(std::memory_order_relaxed);
+      const auto wait_cycles     = counters->wait_cycles.load(std::memory_order_relaxed);
+      const auto max_wait_cycles = counters->max_wait_cycles.load(std::memory_order_relaxed);
+
+      if (!acquire_count)
+      {
+        continue;
+      }
+
+      hvpp_info("  %s: acquired: %" PRIu64 ", contended: %" PRIu64
+                ", wait cycles: %" PRIu64 " (avg: %" PRIu64 ", max: %" PRIu64 ")",
+                counters->name,
+                acquire_count,
+                contended_count,
+                wait_cycles,
+                contended_count ? wait_cycles / contended_count : 0,
+                max_wait_cycles);
+    }
+  }
+}
@@ -0,0 +1,207 @@
+#pragma once
+#include "spinlock.h"
+
+#include "../config.h"
+
+#include "hvpp/ia32/asm.h"
+
+#include <atomic>
+#include <cstdint>
+
+//
+// Spinlock contention statistics.
+//
+// When HVPP_ENABLE_SPINLOCK_STATS is defined, each instance of the
+// instrumented_lock counts how many times it has been acquired, how
+// many of these acquisitions had to wait, total number of cycles (TSC)
+// spent waiting and the longest wait.  Instances are registered (under
+// their name) in the global list when they're constructed, so that
+// statistics of all locks can be printed (spinlock_stats::dump(), called
+// also by vmexit_stats_handler::dump()) or copied into the buffer
+// (spinlock_stats::snapshot(), see hvppdrv IOCTL).
+//
+// When HVPP_ENABLE_SPINLOCK_STATS isn't defined, instrumented_lock<T>
+// is just T - the name is ignored and there is no overhead.
+//
+// Note that (when the statistics are enabled) instrumented_lock has
+// non-trivial constructor and destructor, therefore it shouldn't be
+// used for global variables (see object.h).
+//
+
+namespace spinlock_stats
+{
+  static constexpr size_t max_name_length = 32;
+  static constexpr size_t max_entry_count = 64;
+
+  //
+  // Statistics of single lock (copy).
+  //
+  struct entry_t
+  {
+    char     name[max_name_length];
+    uint64_t acquire_count;
+    uint64_t contended_count;
+    uint64_t wait_cycles;         // Total.
+    uint64_t max_wait_cycles;
+  };
+
+  //
+  // Result of snapshot().  Locks which didn't fit into the "entry"
+  // array are counted in "missing_count".
+  //
+  struct snapshot_t
+  {
+    uint32_t entry_count;
+    uint32_t missing_count;
+    entry_t  entry[max_entry_count];
+  };
+
+  //
+  // Live counters of single lock.
+  //
+  struct counters_t
+  {
+    const char*           name;
+    std::atomic<uint64_t> acquire_count;
+    std::atomic<uint64_t> contended_count;
+    std::atomic<uint64_t> wait_cycles;
+    std::atomic<uint64_t> max_wait_cycles;
+    counters_t*           next;
+
+    void account(uint64_t wait) noexcept
+    {
+      acquire_count.fetch_add(1, std::memory_order_relaxed);
+
+      if (!wait)
+      {
+        return;
+      }
+
+      contended_count.fetch_add(1, std::memory_order_relaxed);
+      wait_cycles.fetch_add(wait, std::memory_order_relaxed);
+
+      auto max_wait = max_wait_cycles.load(std::memory_order_relaxed);
+      while (wait > max_wait &&
+             !max_wait_cycles.compare_exchange_weak(max_wait, wait, std::memory_order_relaxed))
+      {
+        ;
+      }
+    }
+  };
+
+  namespace detail
+  {
+    void attach(counters_t& counters) noexcept;
+    void detach(counters_t& counters) noexcept;
+  }
+
+  //
+  // Copy statistics of all registered locks.
+  //
+  void snapshot(snapshot_t& result) noexcept;
+
+  //
+  // Print statistics of all registered locks (only locks that have
+  // been acquired at least once are printed).
+  //
+  void dump() noexcept;
+}
+
+#ifdef HVPP_ENABLE_SPINLOCK_STATS
+
+template <typename TLock = spinlock>
+class instrumented_lock
+  : public TLock
+{
+  public:
+    explicit instrumented_lock(const char* name) noexcept
+      : TLock{}
+      , counters_{ name }
+    {
+      spinlock_stats::detail::attach(counters_);
+    }
+
+    ~instrumented_lock() noexcept
+    {
+      spinlock_stats::detail::detach(counters_);
+    }
+
+    instrumented_lock(const instrumented_lock& other) noexcept = delete;
+    instrumented_lock(instrumented_lock&& other) noexcept = delete;
+    instrumented_lock& operator=(const instrumented_lock& other) noexcept = delete;
+    instrumented_lock& operator=(instrumented_lock&& other) noexcept = delete;
+
+    bool try_lock() noexcept
+    {
+      if (!TLock::try_lock())
+      {
+        return false;
+      }
+
+      counters_.account(0);
+      return true;
+    }
+
+    void lock() noexcept
+    {
+      //
+      // Don't read the TSC if the lock isn't contended.
+      //
+      if (TLock::try_lock())
+      {
+        counters_.account(0);
+        return;
+      }
+
+      const auto start = ia32_asm_read_tsc();
+      TLock::lock();
+      counters_.account(ia32_asm_read_tsc() - start);
+    }
+
+    //
+    // Shared variants (for reader-writer locks).  Member functions
+    // of the class template are instantiated only when they're used,
+    // therefore these are fine even if TLock doesn't have them.
+    //
+
+    bool try_lock_shared() noexcept
+    {
+      if (!TLock::try_lock_shared())
+      {
+        return false;
+      }
+
+      counters_.account(0);
+      return true;
+    }
+
+    void lock_shared() noexcept
+    {
+      if (TLock::try_lock_shared())
+      {
+        counters_.account(0);
+        return;
+      }
+
+      const auto start = ia32_asm_read_tsc();
+      TLock::lock_shared();
+      counters_.account(ia32_asm_read_tsc() - start);
+    }
+
+  private:
+    spinlock_stats::counters_t counters_;
+};
+
+#else
+
+template <typename TLock = spinlock>
+class instrumented_lock
+  : public TLock
+{
+  public:
+    explicit constexpr instrumented_lock(const char* name) noexcept
+      : TLock{}
+    { (void)(name); }
+};
+
+#endif
@@ -0,0 +1,268 @@
+#include "trace.h"
+
+#include "log.h"
+#include "mp.h"
+#include "spinlock.h"
+
+#include "hvpp/ia32/asm.h"
+
+#include <atomic>
+#include <cstring>
+#include <mutex>
+
+namespace logger::trace
+{
+  namespace
+  {
+    struct slot_t
+    {
+      //
+      // Index of the record + 1.  Set (release) by the producer when
+      // the record is complete.
+      //
+      std::atomic<uint64_t> sequence;
+      record_t              record;
+    };
+
+    struct alignas(64) ring_t
+    {
+      //
+      // Written by producers.
+      //
+      std::atomic<uint64_t> head;
+      std::atomic<uint64_t> dropped_count;
+
+      //
+      // Written by the consumer.
+      //
+      alignas(64) std::atomic<uint64_t> tail;
+
+      alignas(64) slot_t slot[record_count];
+    };
+
+    static_assert((record_count & (record_count - 1)) == 0);
+    static_assert(std::atomic<uint64_t>::is_always_lock_free);
+
+    ring_t*  ring_list_;
+    uint32_t ring_count_;
+
+    //
+    // Serializes consumers.  Note that spinlock is constant-initialized
+    // (no static initializer is emitted), therefore it can be a global
+    // variable.
+    //
+    spinlock read_lock_;
+
+    //
+    // Pass the oldest complete records (ordered by TSC across all
+    // rings) to "fn" and release them.  Stops when there are no more
+    // records or when "fn" returns false.
+    //
+    template <typename TFn>
+    void consume(TFn&& fn) noexcept
+    {
+      if (!ring_list_)
+      {
+        return;
+      }
+
+      std::lock_guard _{ read_lock_ };
+
+      for (;;)
+      {
+        ring_t*  oldest_ring = nullptr;
+        uint32_t oldest_cpu  = 0;
+        uint64_t oldest_tsc  = 0;
+
+        for (uint32_t cpu_index = 0; cpu_index < ring_count_; ++cpu_index)
+        {
+          auto& ring = ring_list_[cpu_index];
+
+          const auto tail = ring.tail.load(std::memory_order_relaxed);
+          const auto& slot = ring.slot[tail & (record_count - 1)];
+
+          if (slot.sequence.load(std::memory_order_acquire) != tail + 1)
+          {
+            continue;
+          }
+
+          if (!oldest_ring || slot.record.tsc < oldest_tsc)
+          {
+            oldest_ring = &ring;
+            oldest_cpu  = cpu_index;
+            oldest_tsc  = slot.record.tsc;
+          }
+        }
+
+        if (!oldest_ring)
+        {
+          break;
+        }
+
+        const auto tail = oldest_ring->tail.load(std::memory_order_relaxed);
+        const auto& slot = oldest_ring->slot[tail & (record_count - 1)];
+
+        if (!fn(oldest_cpu, slot.record))
+        {
+          break;
+        }
+
+        //
+        // Release the slot to the producer.
+        //
+        oldest_ring->tail.store(tail + 1, std::memory_order_release);
+      }
+    }
+  }
+
+  auto initialize() noexcept -> error_code_t
+  {
+    const auto ring_count = mp::cpu_count();
+    const auto ring_list  = reinterpret_cast<ring_t*>(logger::detail::allocate(sizeof(ring_t) * ring_count));
+
+    if (!ring_list)
+    {
+      return make_error_code_t(std::errc::not_enough_memory);
+    }
+
+    memset(ring_list, 0, sizeof(ring_t) * ring_count);
+
+    ring_count_ = ring_count;
+    ring_list_  = ring_list;
+
+    return {};
+  }
+
+  void destroy() noexcept
+  {
+    if (!ring_list_)
+    {
+      return;
+    }
+
+    const auto ring_list = ring_list_;
+
+    ring_list_  = nullptr;
+    ring_count_ = 0;
+
+    logger::detail::free(ring_list);
+  }
+
+  auto read(char* buffer, size_t buffer_size) noexcept -> size_t
+  {
+    size_t bytes_written = 0;
+
+    consume([&](uint32_t cpu_index, const record_t& record) {
+      const auto length = detail::format_record(buffer + bytes_written,
+                                                buffer_size - bytes_written,
+                                                cpu_index,
+                                                record);
+
+      bytes_written += length;
+      return length != 0;
+    });
+
+    return bytes_written;
+  }
+
+  auto read_raw(void* buffer, size_t buffer_size) noexcept -> size_t
+  {
+    const auto data   = reinterpret_cast<uint8_t*>(buffer);
+
+    if (buffer_size < sizeof(format::raw_header_t))
+    {
+      memset(data, 0, buffer_size);
+      return 0;
+    }
+
+    const auto header = reinterpret_cast<format::raw_header_t*>(buffer);
+
+    size_t   bytes_written = sizeof(format::raw_header_t);
+    uint32_t record_count  = 0;
+
+    consume([&](uint32_t cpu_index, const record_t& record) {
+      const auto arg_count = record.entry->arg_count;
+      const auto arg_size  = arg_count * sizeof(uint64_t);
+
+      if (bytes_written + sizeof(format::raw_record_t) + arg_size > buffer_size)
+      {
+        return false;
+      }
+
+      const auto raw_record = reinterpret_cast<format::raw_record_t*>(data + bytes_written);
+      raw_record->format_id = detail::format_id(record.entry);
+      raw_record->cpu_index = static_cast<uint16_t>(cpu_index);
+      raw_record->arg_count = static_cast<uint16_t>(arg_count);
+      raw_record->tsc       = record.tsc;
+      memcpy(raw_record + 1, record.arg, arg_size);
+
+      bytes_written += sizeof(format::raw_record_t) + arg_size;
+      record_count  += 1;
+      return true;
+    });
+
+    header->image_base   = detail::image_base();
+    header->size         = static_cast<uint32_t>(bytes_written);
+    header->record_count = record_count;
+
+    //
+    // The whole buffer might be returned to the user mode (see
+    // ioctl_trace_read_raw() in hvppdrv), therefore don't leave
+    // any uninitialized memory after the last record.
+    //
+    memset(data + bytes_written, 0, buffer_size - bytes_written);
+
+    return bytes_written;
+  }
+
+  auto dropped_count() noexcept -> uint64_t
+  {
+    uint64_t result = 0;
+
+    for (uint32_t cpu_index = 0; cpu_index < ring_count_; ++cpu_index)
+    {
+      result += ring_list_[cpu_index].dropped_count.load(std::memory_order_relaxed);
+    }
+
+    return result;
+  }
+
+  namespace detail
+  {
+    void write(const format::entry_t* entry, const uint64_t* arg, size_t arg_count) noexcept
+    {
+      if (!ring_list_ || !test_level(level_t::trace))
+      {
+        return;
+      }
+
+      auto& ring = ring_list_[mp::cpu_index()];
+
+      //
+      // Reserve the slot.  Compare-exchange protects against
+      // interrupting producer on the same CPU.
+      //
+      auto head = ring.head.load(std::memory_order_relaxed);
+
+      do
+      {
+        if (head - ring.tail.load(std::memory_order_acquire) >= record_count)
+        {
+          ring.dropped_count.fetch_add(1, std::memory_order_relaxed);
+          return;
+        }
+      } while (!ring.head.compare_exchange_weak(head, head + 1, std::memory_order_relaxed));
+
+      auto& slot = ring.slot[head & (record_count - 1)];
+
+      slot.record.tsc   = ia32_asm_read_tsc();
+      slot.record.entry = entry;
+      memcpy(slot.record.arg, arg, arg_count * sizeof(uint64_t));
+
+      //
+      // Publish the record.
+      //
+      slot.sequence.store(head + 1, std::memory_order_release);
+    }
+  }
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include "error.h"
+#include "log_format.h"
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+//
+// Binary trace.
+//
+// When HVPP_ENABLE_BINARY_TRACE is defined, hvpp_trace() doesn't format
+// anything - it just stores pointer to the format entry of the call site
+// (see log_format.h), TSC and raw (64-bit) arguments into the ring buffer
+// of the current CPU.  Formatting is deferred to the consumer, which runs
+// in the non-root mode (e.g. read request on the device), or the records
+// can be read in the raw form and decoded offline.
+//
+// Each CPU has its own ring, therefore producers on different CPUs never
+// touch the same cache lines.  The only case when there are more producers
+// on the same ring is when the producer is interrupted (e.g. VM-exit
+// in the middle of hvpp_trace() called from the guest mode, or NMI).
+// Slot is therefore reserved by compare-exchange on the "head" index
+// and published by storing its sequence number.
+//
+// If the ring is full, the record is dropped and the drop counter of the
+// ring is incremented.
+//
+// Note that "%s" arguments are stored as pointers, which means they must
+// be static strings - e.g. results of to_string() functions are fine,
+// strings on the stack are not.
+//
+
+namespace logger::trace
+{
+  static constexpr size_t max_arg_count = format::max_arg_count;
+
+  //
+  // Number of records in the ring of each CPU.  Must be power of 2.
+  //
+  static constexpr size_t record_count  = 512;
+
+  struct record_t
+  {
+    uint64_t                tsc;
+    const format::entry_t*  entry;
+    uint64_t                arg[max_arg_count];
+  };
+
+  namespace detail
+  {
+    //
+    // Format single record as "#cpu\ttsc\tfunction\tmessage\r\n".
+    // Returns number of characters written (without the terminating
+    // null character), or 0 if the buffer is too small.
+    //
+    auto  format_record(char* buffer, size_t buffer_size, uint32_t cpu_index, const record_t& record) noexcept -> size_t;
+
+    //
+    // Runtime base address of the image and index of the entry
+    // in the format-string section.
+    //
+    auto  image_base() noexcept -> uint64_t;
+    auto  format_id(const format::entry_t* entry) noexcept -> uint32_t;
+
+    void  write(const format::entry_t* entry, const uint64_t* arg, size_t arg_count) noexcept;
+
+    template <typename T>
+    uint64_t to_arg(T value) noexcept
+    {
+      if constexpr (std::is_null_pointer_v<T>)
+      {
+        return 0;
+      }
+      else if constexpr (std::is_pointer_v<T>)
+      {
+        return reinterpret_cast<uint64_t>(value);
+      }
+      else if constexpr (std::is_floating_point_v<T>)
+      {
+        //
+        // Variadic functions receive floats promoted to double.
+        //
+        const double double_value = value;
+
+        uint64_t result;
+        memcpy(&result, &double_value, sizeof(result));
+        return result;
+      }
+      else
+      {
+        static_assert(std::is_integral_v<T> || std::is_enum_v<T>,
+                      "Only integral, enum, floating-point and pointer arguments are supported");
+
+        return static_cast<uint64_t>(value);
+      }
+    }
+  }
+
+  auto initialize() noexcept -> error_code_t;
+  void destroy() noexcept;
+
+  template <typename ...TArgs>
+  void write(const format::entry_t* entry, TArgs... args) noexcept
+  {
+    static_assert(sizeof...(TArgs) <= max_arg_count, "Too many arguments");
+
+    const uint64_t arg[] = { detail::to_arg(args)..., 0 };
+    detail::write(entry, arg, sizeof...(TArgs));
+  }
+
+  //
+  // Format pending records (ordered by TSC across all CPUs) into
+  // the buffer and remove them from the rings.  Only whole lines are
+  // written.  Returns number of bytes written.
+  //
+  auto read(char* buffer, size_t buffer_size) noexcept -> size_t;
+
+  //
+  // Same as read(), but the records are serialized in the raw form
+  // (format ID and raw arguments - see format::raw_header_t).
+  // Only whole records are written.  Returns number of bytes written
+  // (0 if the buffer can't hold even the header).  The rest of the
+  // buffer is zeroed.
+  //
+  auto read_raw(void* buffer, size_t buffer_size) noexcept -> size_t;
+
+  //
+  // Total number of records dropped because the ring was full.
+  //
+  auto dropped_count() noexcept -> uint64_t;
+}
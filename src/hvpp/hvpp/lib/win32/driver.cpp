@@ -98,6 +98,10 @@ DriverDispatch(
       err = CppDeviceObject->on_create();
       break;
 
+    case IRP_MJ_CLEANUP:
+      err = CppDeviceObject->on_cleanup();
+      break;
+
     case IRP_MJ_CLOSE:
       err = CppDeviceObject->on_close();
       break;
@@ -282,6 +286,7 @@ DriverEntry(
 
   GlobalDriverObject = DriverObject;
   DriverObject->MajorFunction[IRP_MJ_CREATE]         = &DriverDispatch;
+  DriverObject->MajorFunction[IRP_MJ_CLEANUP]        = &DriverDispatch;
   DriverObject->MajorFunction[IRP_MJ_CLOSE]          = &DriverDispatch;
   DriverObject->MajorFunction[IRP_MJ_READ]           = &DriverDispatch;
   DriverObject->MajorFunction[IRP_MJ_WRITE]          = &DriverDispatch;
@@ -4,6 +4,8 @@
 
 #include "../mp.h"
 
+#include "hvpp/ia32/asm.h"
+
 #include <ntddk.h>
 
 EXTERN_C
@@ -14,6 +16,8 @@ PsGetProcessImageFileName (
     _In_ PEPROCESS Process
     );
 
+#define HVPP_LOG_TAG 'glvh'
+
 namespace logger::detail
 {
   template <size_t SIZE>
@@ -120,4 +124,35 @@ namespace logger::detail
       do_print(buffer);
     }
   }
+
+  void* allocate(size_t size) noexcept
+  {
+    return ExAllocatePoolWithTag(NonPagedPool, size, HVPP_LOG_TAG);
+  }
+
+  void free(void* address) noexcept
+  {
+    ExFreePoolWithTag(address, HVPP_LOG_TAG);
+  }
+
+  auto tsc_frequency() noexcept -> uint64_t
+  {
+    //
+    // Measure TSC against the performance counter over 1ms.
+    //
+    LARGE_INTEGER frequency;
+    const auto counter_begin = KeQueryPerformanceCounter(&frequency).QuadPart;
+    const auto tsc_begin     = ia32_asm_read_tsc();
+
+    KeStallExecutionProcessor(1000);
+
+    const auto counter_end   = KeQueryPerformanceCounter(nullptr).QuadPart;
+    const auto tsc_end       = ia32_asm_read_tsc();
+
+    const auto counter_delta = static_cast<uint64_t>(counter_end - counter_begin);
+
+    return counter_delta
+      ? (tsc_end - tsc_begin) * static_cast<uint64_t>(frequency.QuadPart) / counter_delta
+      : 0;
+  }
 }
@@ -8,14 +8,40 @@ namespace mp::detail
 {
   uint32_t cpu_count() noexcept
   {
-    return KeQueryActiveProcessorCountEx(0);
+    //
+    // Count CPUs in all processor groups - not just in the group 0
+    // (which holds at most 64 CPUs).  System-wide indices returned
+    // by KeGetCurrentProcessorNumberEx() are in range of the maximum
+    // (not active) processor count.
+    //
+    return KeQueryMaximumProcessorCountEx(ALL_PROCESSOR_GROUPS);
+  }
+
+  uint32_t cpu_active_count() noexcept
+  {
+    return KeQueryActiveProcessorCountEx(ALL_PROCESSOR_GROUPS);
   }
 
   uint32_t cpu_index() noexcept
   {
+    //
+    // System-wide index of the CPU (across processor groups).
+    //
     return KeGetCurrentProcessorNumberEx(NULL);
   }
 
+  bool cpu_is_active(uint32_t cpu_index) noexcept
+  {
+    PROCESSOR_NUMBER processor_number;
+
+    if (!NT_SUCCESS(KeGetProcessorNumberFromIndex(cpu_index, &processor_number)))
+    {
+      return false;
+    }
+
+    return !!(KeQueryGroupAffinity(processor_number.Group) & (KAFFINITY(1) << processor_number.Number));
+  }
+
   void sleep(uint32_t milliseconds) noexcept
   {
     LARGE_INTEGER interval;
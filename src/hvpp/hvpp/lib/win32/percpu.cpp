@@ -0,0 +1,21 @@
+#include "../percpu.h"
+
+#include <ntddk.h>
+
+#define HVPP_PERCPU_TAG 'cpvh'
+
+namespace percpu::detail
+{
+  auto allocate(size_t size) noexcept -> void*
+  {
+    //
+    // Allocations of at least one page are page-aligned.
+    //
+    return ExAllocatePoolWithTag(NonPagedPool, size, HVPP_PERCPU_TAG);
+  }
+
+  void free(void* address) noexcept
+  {
+    ExFreePoolWithTag(address, HVPP_PERCPU_TAG);
+  }
+}
@@ -0,0 +1,72 @@
+#include "../shared_ring.h"
+
+#include <ntddk.h>
+
+#define HVPP_SHARED_RING_TAG 'rsvh'
+
+namespace detail
+{
+  void* shared_ring_allocate(size_t size, void*& mdl) noexcept
+  {
+    void* va = ExAllocatePoolWithTag(NonPagedPool, size, HVPP_SHARED_RING_TAG);
+
+    if (!va)
+    {
+      return nullptr;
+    }
+
+    PMDL Mdl = IoAllocateMdl(va, (ULONG)size, FALSE, FALSE, NULL);
+
+    if (!Mdl)
+    {
+      ExFreePoolWithTag(va, HVPP_SHARED_RING_TAG);
+      return nullptr;
+    }
+
+    MmBuildMdlForNonPagedPool(Mdl);
+
+    mdl = Mdl;
+    return va;
+  }
+
+  void shared_ring_free(void* va, void* mdl) noexcept
+  {
+    IoFreeMdl((PMDL)mdl);
+    ExFreePoolWithTag(va, HVPP_SHARED_RING_TAG);
+  }
+
+  void* shared_ring_map_user(void* mdl) noexcept
+  {
+    void* user_va;
+
+    //
+    // MmMapLockedPagesSpecifyCache raises an exception on failure
+    // when AccessMode is UserMode.
+    //
+    __try
+    {
+      user_va = MmMapLockedPagesSpecifyCache((PMDL)mdl,
+                                             UserMode,
+                                             MmCached,
+                                             NULL,
+                                             FALSE,
+                                             NormalPagePriority | MdlMappingNoExecute);
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER)
+    {
+      user_va = nullptr;
+    }
+
+    return user_va;
+  }
+
+  void shared_ring_unmap_user(void* user_va, void* mdl) noexcept
+  {
+    MmUnmapLockedPages(user_va, (PMDL)mdl);
+  }
+
+  void* shared_ring_current_process() noexcept
+  {
+    return PsGetCurrentProcess();
+  }
+}
@@ -0,0 +1,55 @@
+#define _NO_CRT_STDIO_INLINE
+
+#include "../trace.h"
+
+#include <ntddk.h>
+#include <ntstrsafe.h>
+
+//
+// Provided by the linker.
+//
+EXTERN_C UCHAR __ImageBase;
+
+//
+// Begin of the format-string section (see log_format.h).
+//
+HVPP_FORMAT_SECTION_BEGIN
+static const logger::format::entry_t format_section_begin = {};
+
+namespace logger::trace::detail
+{
+  auto image_base() noexcept -> uint64_t
+  {
+    return reinterpret_cast<uint64_t>(&__ImageBase);
+  }
+
+  auto format_id(const format::entry_t* entry) noexcept -> uint32_t
+  {
+    return static_cast<uint32_t>(entry - &format_section_begin);
+  }
+
+  auto format_record(char* buffer, size_t buffer_size, uint32_t cpu_index, const record_t& record) noexcept -> size_t
+  {
+    char log_message[512];
+
+    //
+    // On x64, va_list is just a pointer to the array of 64-bit
+    // arguments - which is exactly what the record holds.
+    //
+    // RtlStringCbVPrintfA() truncates the message if it doesn't fit.
+    //
+    RtlStringCbVPrintfA(log_message, sizeof(log_message),
+                        record.entry->format,
+                        reinterpret_cast<va_list>(const_cast<uint64_t*>(record.arg)));
+
+    char* end;
+    const auto status = RtlStringCbPrintfExA(buffer, buffer_size, &end, nullptr, 0,
+                                             "#%u\t%llu\t%s\t%s\r\n",
+                                             cpu_index, record.tsc,
+                                             record.entry->function, log_message);
+
+    return NT_SUCCESS(status)
+      ? static_cast<size_t>(end - buffer)
+      : 0;
+  }
+}
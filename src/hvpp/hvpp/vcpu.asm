@@ -40,8 +40,22 @@ INCLUDE ia32/common.inc
     VCPU_CONTEXT_OFFSET                 =  0                 ; ..
     VCPU_LAUNCH_CONTEXT_OFFSET          =  0                 ; ... connected by union {}
                                                              ;
+    VCPU_FAST_EXIT_MASK_OFFSET          =  90h               ; sizeof(context_t)
+    VCPU_REQUEST_PENDING_OFFSET         =  98h               ; + sizeof(fast_exit_mask_)
     SHADOW_SPACE                        =  20h
 
+;
+; VMCS fields and exit reasons used by entry_host_fast_.
+;
+    VMCS_EXIT_REASON                    =  4402h
+    VMCS_VMEXIT_INSTRUCTION_LENGTH      =  440Ch
+    VMCS_GUEST_RIP                      =  681Eh
+
+    EXIT_REASON_EXECUTE_CPUID           =  10
+    EXIT_REASON_EXECUTE_RDTSC           =  16
+    EXIT_REASON_EXECUTE_RDTSCP          =  51
+    EXIT_REASON_EXECUTE_XSETBV          =  55
+
 ;
 ; Externally used symbols.
 ;
@@ -232,4 +246,126 @@ INCLUDE ia32/common.inc
         jmp     ?restore@context_t@ia32@@QEAAXXZ
     ?entry_host_@vcpu_t@hvpp@@CAXXZ ENDP
 
+;++
+;
+; private:
+;   static void __cdecl
+;   hvpp::vcpu_t::entry_host_fast_(void)
+;
+; Routine description:
+;
+;   This method is used as HOST_RIP instead of vcpu_t::entry_host_() if
+;   any "fast" VM-exit is enabled (see vcpu_t::fast_exit_enable()).
+;
+;   Trivial VM-exits (CPUID, RDTSC, RDTSCP, XSETBV) enabled in the
+;   vcpu.fast_exit_mask_ are handled right here - the instruction is
+;   executed on behalf of the guest, guest RIP is advanced and the
+;   guest is resumed.  No C++ code is executed, therefore only RAX, RCX
+;   and RDX (and RBX for CPUID) are touched and neither the full context
+;   nor the x87/SSE state is saved.
+;
+;   All other VM-exits are passed to the vcpu_t::entry_host_() with
+;   unchanged registers.
+;
+;   Note that vcpu.context_ is used as a scratch space - it's overwritten
+;   by vcpu_t::entry_host_() anyway.
+;
+;--
+
+    ?entry_host_fast_@vcpu_t@hvpp@@CAXXZ PROC
+        mov     context_t.$rax[rsp], rax
+        mov     context_t.$rcx[rsp], rcx
+        mov     context_t.$rdx[rsp], rdx
+
+;
+; EAX = exit reason
+; Take the slow path if the VM-entry failed (bit 31), if the basic exit
+; reason is not enabled in the vcpu.fast_exit_mask_ or if there are
+; pending cross-VCPU requests (see vcpu_t::request_post()).
+;
+        mov     rcx, VMCS_EXIT_REASON
+        vmread  rax, rcx
+
+        cmp     eax, 64
+        jae     slow_path
+
+        mov     rdx, qword ptr [rsp + VCPU_FAST_EXIT_MASK_OFFSET]
+        bt      rdx, rax
+        jnc     slow_path
+
+        cmp     byte ptr [rsp + VCPU_REQUEST_PENDING_OFFSET], 0
+        jne     slow_path
+
+        cmp     eax, EXIT_REASON_EXECUTE_CPUID
+        je      exit_cpuid
+        cmp     eax, EXIT_REASON_EXECUTE_RDTSC
+        je      exit_rdtsc
+        cmp     eax, EXIT_REASON_EXECUTE_RDTSCP
+        je      exit_rdtscp
+        cmp     eax, EXIT_REASON_EXECUTE_XSETBV
+        je      exit_xsetbv
+        jmp     slow_path
+
+;
+; Note that in 64-bit mode, instructions below clear upper 32 bits
+; of the destination registers.
+;
+exit_cpuid:
+        mov     eax, dword ptr context_t.$rax[rsp]
+        mov     ecx, dword ptr context_t.$rcx[rsp]
+        cpuid
+        mov     context_t.$rax[rsp], rax
+        mov     context_t.$rcx[rsp], rcx
+        mov     context_t.$rdx[rsp], rdx
+        jmp     advance_rip
+
+exit_rdtsc:
+        rdtsc
+        mov     context_t.$rax[rsp], rax
+        mov     context_t.$rdx[rsp], rdx
+        jmp     advance_rip
+
+exit_rdtscp:
+        rdtscp
+        mov     context_t.$rax[rsp], rax
+        mov     context_t.$rcx[rsp], rcx
+        mov     context_t.$rdx[rsp], rdx
+        jmp     advance_rip
+
+exit_xsetbv:
+        mov     eax, dword ptr context_t.$rax[rsp]
+        mov     ecx, dword ptr context_t.$rcx[rsp]
+        mov     edx, dword ptr context_t.$rdx[rsp]
+        xsetbv
+
+;
+; GUEST_RIP += VMEXIT_INSTRUCTION_LENGTH
+;
+advance_rip:
+        mov     rcx, VMCS_GUEST_RIP
+        vmread  rax, rcx
+        mov     rcx, VMCS_VMEXIT_INSTRUCTION_LENGTH
+        vmread  rdx, rcx
+        add     rax, rdx
+        mov     rcx, VMCS_GUEST_RIP
+        vmwrite rcx, rax
+
+        mov     rax, context_t.$rax[rsp]
+        mov     rcx, context_t.$rcx[rsp]
+        mov     rdx, context_t.$rdx[rsp]
+        vmresume
+
+;
+; If we got here, VMRESUME failed - the VMCS is in inconsistent state
+; and there is no way to return to the guest.
+;
+        int     3
+
+slow_path:
+        mov     rax, context_t.$rax[rsp]
+        mov     rcx, context_t.$rcx[rsp]
+        mov     rdx, context_t.$rdx[rsp]
+        jmp     ?entry_host_@vcpu_t@hvpp@@CAXXZ
+    ?entry_host_fast_@vcpu_t@hvpp@@CAXXZ ENDP
+
 END
@@ -1,17 +1,66 @@
+#define HVPP_LOG_MODULE vcpu
+
 #include "vcpu.h"
 #include "vmexit.h"
+#include "config.h"
 
+#include "ia32/cpuid/cpuid_eax_01.h"
 #include "lib/assert.h"
 #include "lib/log.h"
 #include "lib/mm.h"
 #include "lib/cr3_guard.h"
 
-#include <iterator> // std::end()
+#include <algorithm> // std::none_of(), std::equal()
+#include <iterator> // std::begin(), std::end()
 
 #include "vcpu.inl"
 
 namespace hvpp {
 
+namespace detail
+{
+  //
+  // Determine which XSAVE instruction should be used for saving of the
+  // extended state and how big the XSAVE area must be.
+  // (ref: Vol1[13.2(Enumeration of CPU Support for XSAVE Instructions
+  //                 and XSAVE-Supported Features)])
+  //
+  static bool xsave_detect(uint32_t& area_size, bool& has_xsaveopt, bool& has_xsavec) noexcept
+  {
+    cpuid_eax_01 cpuid_info;
+    ia32_asm_cpuid(cpuid_info.cpu_info, 1);
+
+    //
+    // XSAVE must be supported by the CPU and enabled by the OS
+    // (CR4.OSXSAVE) - otherwise XSAVE instructions raise #UD.
+    //
+    if (!cpuid_info.feature_information_ecx.xsave_xrstor_instruction ||
+        !read<cr4_t>().os_xsave)
+    {
+      return false;
+    }
+
+    uint32_t cpu_info[4];
+
+    //
+    // CPUID.(EAX=0DH,ECX=0):ECX - size of the XSAVE area (standard
+    // format) required by all state-components supported by the CPU.
+    // The compacted format never needs more.
+    //
+    ia32_asm_cpuid_ex(cpu_info, 0x0000'000d, 0);
+    area_size = cpu_info[2];
+
+    //
+    // CPUID.(EAX=0DH,ECX=1):EAX[0] - XSAVEOPT, EAX[1] - XSAVEC.
+    //
+    ia32_asm_cpuid_ex(cpu_info, 0x0000'000d, 1);
+    has_xsaveopt = !!(cpu_info[0] & (1 << 0));
+    has_xsavec   = !!(cpu_info[0] & (1 << 1));
+
+    return area_size >= sizeof(fxsave_area_t) + sizeof(xsave_area_header_t);
+  }
+}
+
 //
 // Public
 //
@@ -32,6 +81,33 @@ vcpu_t::vcpu_t(vmexit_handler& handler) noexcept
   // , msr_bitmap_{}
   // , io_bitmap_{}
 
+  //
+  // All VM-exits go through vcpu_t::entry_host() by default.
+  //
+  , fast_exit_mask_{}
+  , request_pending_{ false }
+
+  //
+  // Save full x87/SSE state on each VM-exit, unless HVPP_LAZY_FP_STATE
+  // is defined.
+  //
+  , fp_state_saved_{}
+#ifdef HVPP_LAZY_FP_STATE
+  , fp_state_eager_{ false }
+#else
+  , fp_state_eager_{ true }
+#endif
+
+  //
+  // XSAVE area is allocated below (if XSAVE is supported).
+  // Only x87 and SSE state is saved by default.
+  //
+  , xsave_area_{}
+  , xsave_area_size_{}
+  , xsave_instruction_{ xsave_instruction::none }
+  , xsave_mask_{ xsave_component::legacy }
+  , xsave_mask_saved_{}
+
   , handler_ { handler }
 
   //
@@ -45,6 +121,16 @@ vcpu_t::vcpu_t(vmexit_handler& handler) noexcept
   //
   , ept_{}
 
+  //
+  // Guest-resume is supported by default.
+  //
+  , resume_context_enabled_{ true }
+
+  //
+  // Kernel CR3 of the guest is computed on demand.
+  //
+  , guest_kernel_cr3_{}
+
   //
   // Initialize timestamp-counter members.
   //
@@ -52,6 +138,12 @@ vcpu_t::vcpu_t(vmexit_handler& handler) noexcept
   , tsc_delta_previous_{}
   , tsc_delta_sum_{}
 
+  //
+  // No pending cross-VCPU requests.
+  //
+  , request_queue_{}
+  , request_overflow_{ false }
+
   , user_data_{}
 
   //
@@ -65,6 +157,32 @@ vcpu_t::vcpu_t(vmexit_handler& handler) noexcept
   //
   memset(&stack_.data, 0xcc, sizeof(stack_));
 
+  //
+  // Allocate XSAVE area.  It must be 64-byte aligned and its header
+  // must be zeroed.  If the allocation fails, the VCPU works just fine
+  // with FXSAVE, only fp_state_mask() can't be extended.
+  //
+  bool has_xsaveopt;
+  bool has_xsavec;
+
+  if (detail::xsave_detect(xsave_area_size_, has_xsaveopt, has_xsavec))
+  {
+    xsave_area_ = reinterpret_cast<uint8_t*>(operator new[](xsave_area_size_, std::align_val_t(64)));
+
+    if (xsave_area_)
+    {
+      memset(xsave_area_, 0, xsave_area_size_);
+
+      //
+      // Prefer XSAVEOPT - unlike XSAVEC, it also skips state-components
+      // which haven't been modified since they were restored by XRSTOR.
+      //
+      xsave_instruction_ = has_xsaveopt ? xsave_instruction::xsaveopt
+                         : has_xsavec   ? xsave_instruction::xsavec
+                         :                xsave_instruction::xsave;
+    }
+  }
+
   //
   // Reset CPU contexts.
   // This is not really needed, as they are overwritten anyway (in
@@ -90,10 +208,15 @@ vcpu_t::vcpu_t(vmexit_handler& handler) noexcept
     constexpr intptr_t VCPU_CONTEXT_OFFSET              =   0;        // ..
     constexpr intptr_t VCPU_LAUNCH_CONTEXT_OFFSET       =   0;        // ... connected by union {}
                                                                       //
+    constexpr intptr_t VCPU_FAST_EXIT_MASK_OFFSET       =   0x90;     // sizeof(context_t)
+    constexpr intptr_t VCPU_REQUEST_PENDING_OFFSET      =   0x98;     // + sizeof(fast_exit_mask_)
 
     static_assert(VCPU_RSP + VCPU_OFFSET                == offsetof(vcpu_t, stack_));
     static_assert(VCPU_RSP + VCPU_CONTEXT_OFFSET        == offsetof(vcpu_t, context_));
     static_assert(VCPU_RSP + VCPU_LAUNCH_CONTEXT_OFFSET == offsetof(vcpu_t, launch_context_));
+    static_assert(VCPU_RSP + VCPU_FAST_EXIT_MASK_OFFSET == offsetof(vcpu_t, fast_exit_mask_));
+    static_assert(VCPU_RSP + VCPU_REQUEST_PENDING_OFFSET == offsetof(vcpu_t, request_pending_));
+    static_assert(sizeof(vcpu_t::request_pending_) == 1);
 
     //
     // The Windows x64 ABI assumes that each function is called with 16-byte
@@ -143,6 +266,14 @@ vcpu_t::~vcpu_t() noexcept
   {
     stop();
   }
+
+  if (xsave_area_)
+  {
+    //
+    // Must match the aligned operator new[] in the constructor.
+    //
+    operator delete[](xsave_area_, std::align_val_t(64));
+  }
 }
 
 auto vcpu_t::start() noexcept -> error_code_t
@@ -402,10 +533,78 @@ void vcpu_t::user_data(void* new_data) noexcept
 
 void vcpu_t::guest_resume() noexcept
 {
+  //
+  // There's no context to return to - resume_context_ isn't captured
+  // on VM-exit if guest-resume is disabled (it might be stale or never
+  // captured at all).  This must not depend on hvpp_assert, which might
+  // be compiled out.
+  //
+  if (!resume_context_enabled_)
+  {
+    hvpp_error("guest_resume() called while guest-resume is disabled");
+    hvpp_assert(0);
+    return;
+  }
+
   resume_context_.rax = 1;
   resume_context_.restore();
 }
 
+auto vcpu_t::fast_exit_enable(vmx::exit_reason exit_reason) noexcept -> error_code_t
+{
+  switch (exit_reason)
+  {
+    case vmx::exit_reason::execute_cpuid:
+    case vmx::exit_reason::execute_rdtsc:
+    case vmx::exit_reason::execute_rdtscp:
+    case vmx::exit_reason::execute_xsetbv:
+      fast_exit_mask(fast_exit_mask_ | (1ull << static_cast<uint32_t>(exit_reason)));
+      return {};
+
+    default:
+      return make_error_code_t(std::errc::not_supported);
+  }
+}
+
+void vcpu_t::fast_exit_disable(vmx::exit_reason exit_reason) noexcept
+{
+  if (static_cast<uint32_t>(exit_reason) < 64)
+  {
+    fast_exit_mask(fast_exit_mask_ & ~(1ull << static_cast<uint32_t>(exit_reason)));
+  }
+}
+
+bool vcpu_t::fast_exit_is_enabled(vmx::exit_reason exit_reason) const noexcept
+{
+  return static_cast<uint32_t>(exit_reason) < 64 &&
+         (fast_exit_mask_ & (1ull << static_cast<uint32_t>(exit_reason)));
+}
+
+void vcpu_t::guest_resume_enable() noexcept
+{
+  resume_context_enabled_ = true;
+}
+
+void vcpu_t::guest_resume_disable() noexcept
+{
+  //
+  // Stacked lock guards rely on guest_resume() context.
+  //
+  hvpp_assert(spinlock_queue_.size() == 0);
+
+  resume_context_enabled_ = false;
+}
+
+bool vcpu_t::guest_resume_is_enabled() const noexcept
+{
+  return resume_context_enabled_;
+}
+
+auto vcpu_t::guest_cpuid_cache() noexcept -> cpuid_cache_t&
+{
+  return cpuid_cache_;
+}
+
 auto vcpu_t::guest_memory_mapper() noexcept -> mm::memory_mapper&
 {
   return mapper_;
@@ -416,19 +615,215 @@ auto vcpu_t::guest_memory_translator() noexcept -> mm::memory_translator&
   return translator_;
 }
 
+auto vcpu_t::guest_kernel_cr3() noexcept -> cr3_t
+{
+  //
+  // detail::kernel_cr3() reads guest CR3 from the VMCS and possibly
+  // the current process structure - do it only once per VM-exit.
+  //
+  if (!guest_kernel_cr3_.flags)
+  {
+    guest_kernel_cr3_ = ::detail::kernel_cr3(guest_cr3());
+  }
+
+  return guest_kernel_cr3_;
+}
+
 auto vcpu_t::guest_va_to_pa(va_t guest_va) noexcept -> pa_t
 {
-  return translator_.va_to_pa(guest_va, ::detail::kernel_cr3(guest_cr3()));
+  return translator_.va_to_pa(guest_va, guest_kernel_cr3());
 }
 
 auto vcpu_t::guest_read_memory(va_t guest_va, void* buffer, size_t size, bool ignore_errors /* = false */) noexcept -> va_t
 {
-  return translator_.read(guest_va, ::detail::kernel_cr3(guest_cr3()), buffer, size, ignore_errors);
+  return translator_.read(guest_va, guest_kernel_cr3(), buffer, size, ignore_errors);
+}
+
+auto vcpu_t::guest_read_memory_batch(mm::memory_translator::batch_entry_t* entry_list, size_t count, bool ignore_errors /* = false */) noexcept -> size_t
+{
+  return translator_.read_batch(entry_list, count, guest_kernel_cr3(), ignore_errors);
 }
 
 auto vcpu_t::guest_write_memory(va_t guest_va, const void* buffer, size_t size, bool ignore_errors /* = false */) noexcept -> va_t
 {
-  return translator_.write(guest_va, ::detail::kernel_cr3(guest_cr3()), buffer, size, ignore_errors);
+  return translator_.write(guest_va, guest_kernel_cr3(), buffer, size, ignore_errors);
+}
+
+void vcpu_t::fp_state_save() noexcept
+{
+  if (fp_state_saved_)
+  {
+    return;
+  }
+
+  //
+  // Remember the mask - the same components must be restored, even
+  // if the mask is changed in the meantime.
+  //
+  xsave_mask_saved_ = xsave_mask_;
+
+  if (xsave_mask_saved_ == xsave_component::legacy)
+  {
+    ia32_asm_fx_save(&fxsave_area_);
+  }
+  else
+  {
+    switch (xsave_instruction_)
+    {
+      case xsave_instruction::xsaveopt:
+        ia32_asm_xsave_opt(xsave_area_, xsave_mask_saved_);
+        break;
+
+      case xsave_instruction::xsavec:
+        ia32_asm_xsave_c(xsave_area_, xsave_mask_saved_);
+        break;
+
+      default:
+        ia32_asm_xsave(xsave_area_, xsave_mask_saved_);
+        break;
+    }
+  }
+
+  fp_state_saved_ = true;
+}
+
+bool vcpu_t::fp_state_is_saved() const noexcept
+{
+  return fp_state_saved_;
+}
+
+auto vcpu_t::fp_state_mask(uint64_t mask) noexcept -> error_code_t
+{
+  //
+  // x87 and SSE state is always saved.
+  //
+  mask |= xsave_component::legacy;
+
+  if (mask != xsave_component::legacy && xsave_instruction_ == xsave_instruction::none)
+  {
+    return make_error_code_t(std::errc::not_supported);
+  }
+
+  xsave_mask_ = mask;
+  return {};
+}
+
+auto vcpu_t::fp_state_mask() const noexcept -> uint64_t
+{
+  return xsave_mask_;
+}
+
+void vcpu_t::fp_state_eager(bool value) noexcept
+{
+#ifdef HVPP_LAZY_FP_STATE
+  fp_state_eager_ = value;
+#else
+  (void)(value);
+#endif
+}
+
+bool vcpu_t::fp_state_eager() const noexcept
+{
+  return fp_state_eager_;
+}
+
+bool vcpu_t::request_post(const request_t& request) noexcept
+{
+  if (!request_queue_.push(request))
+  {
+    if (request.type == request_t::type_t::callback)
+    {
+      return false;
+    }
+
+    //
+    // The queue is full - INVEPT can still be satisfied by performing
+    // all-context INVEPT.
+    //
+    request_overflow_.store(true, std::memory_order_release);
+  }
+
+  //
+  // Set the "pending" flag only after the request has been published,
+  // so that request_process() (which clears the flag before it drains
+  // the queue) never misses it.  The flag also forces the fast VM-exits
+  // to take the slow path (see vcpu.asm).
+  //
+  request_pending_.store(true, std::memory_order_release);
+  return true;
+}
+
+void vcpu_t::request_process() noexcept
+{
+  //
+  // Drain the queue into the batch first, deduplicate requests on
+  // the way.  Requests posted while the batch is being executed are
+  // processed on the next VM-exit.
+  //
+  request_pending_.exchange(false, std::memory_order_acquire);
+
+  ept_ptr_t invept_list[request_queue_size];
+  size_t    invept_count = 0;
+  bool      invept_all   = request_overflow_.exchange(false, std::memory_order_acquire);
+
+  request_t callback_list[request_queue_size];
+  size_t    callback_count = 0;
+
+  request_t request;
+  for (size_t i = 0; i < request_queue_size && request_queue_.pop(request); ++i)
+  {
+    switch (request.type)
+    {
+      case request_t::type_t::invept_single_context:
+        if (!invept_all &&
+            std::none_of(invept_list, invept_list + invept_count, [&](const ept_ptr_t& item) {
+              return item.flags == request.ept_pointer.flags;
+            }))
+        {
+          invept_list[invept_count++] = request.ept_pointer;
+        }
+        break;
+
+      case request_t::type_t::invept_all_contexts:
+        invept_all = true;
+        break;
+
+      case request_t::type_t::callback:
+        if (!callback_count ||
+            callback_list[callback_count - 1].callback != request.callback ||
+            callback_list[callback_count - 1].context  != request.context  ||
+            !std::equal(std::begin(request.argument), std::end(request.argument),
+                        std::begin(callback_list[callback_count - 1].argument)))
+        {
+          callback_list[callback_count++] = request;
+        }
+        break;
+
+      default:
+        hvpp_assert(0);
+        break;
+    }
+  }
+
+  //
+  // Callbacks might modify EPT - call them before the invalidation.
+  //
+  for (size_t i = 0; i < callback_count; ++i)
+  {
+    callback_list[i].callback(*this, callback_list[i]);
+  }
+
+  if (invept_all)
+  {
+    vmx::invept_all_contexts();
+  }
+  else
+  {
+    for (size_t i = 0; i < invept_count; ++i)
+    {
+      vmx::invept_single_context(invept_list[i]);
+    }
+  }
 }
 
 auto vcpu_t::tsc_entry() const noexcept -> uint64_t
@@ -611,10 +1006,10 @@ auto vcpu_t::setup_host() noexcept -> error_code_t
   // Because current function can be called in context of any process (which
   // can die at any time), we can't use current CR3 for the hypervisor.
   // We MUST use such CR3 that will live long enough - which is "System"
-  // process.
+  // process (or its copy with the direct map - see mm::host_cr3()).
   //
   host_cr0(read<cr0_t>());
-  host_cr3(mm::paging_descriptor().system_cr3());
+  host_cr3(mm::host_cr3());
   host_cr4(read<cr4_t>());
 
   //
@@ -740,6 +1135,22 @@ auto vcpu_t::setup_guest() noexcept -> error_code_t
   return {};
 }
 
+void vcpu_t::fast_exit_mask(uint64_t mask) noexcept
+{
+  hvpp_assert(state_ == state::initializing ||
+              state_ == state::running);
+
+  fast_exit_mask_ = mask;
+
+  //
+  // Don't put the fast-path stub in front of every VM-exit if
+  // there's nothing to handle.
+  //
+  host_rip(fast_exit_mask_
+    ? reinterpret_cast<uint64_t>(&vcpu_t::entry_host_fast_)
+    : reinterpret_cast<uint64_t>(&vcpu_t::entry_host_));
+}
+
 void vcpu_t::entry_host() noexcept
 {
   hvpp_assert(state_ == state::running ||
@@ -752,6 +1163,21 @@ void vcpu_t::entry_host() noexcept
   //
   suppress_rip_adjust_ = false;
 
+  //
+  // Reset cached kernel CR3 of the guest.
+  //
+  guest_kernel_cr3_.flags = 0;
+
+  //
+  // Guest could have changed its page-tables since the last VM-exit.
+  // Translations cached by the memory translator can't be trusted
+  // anymore - unless the VM-exit handler tracks all TLB invalidations.
+  //
+  if (!translator_.cache_persistent())
+  {
+    translator_.flush();
+  }
+
   //
   // Execute "fxsave" instruction.  This causes to save x87 state and SSE
   // state.  It includes x87 registers (st0-st7 / mm0-mm7), XMM registers
@@ -771,9 +1197,33 @@ void vcpu_t::entry_host() noexcept
   // Note that there exists newer pair of instructions "xsave" and "xrstor"
   // which is also capable (among other things) of saving/restoring AVX state.
   // But as long as we're not compiled with AVX support, fxsave/fxrstor should
-  // be enough.
-  //
-  ia32_asm_fx_save(&fxsave_area_);
+  // be enough.  If the handlers are compiled with AVX support, the AVX
+  // state-component must be added via fp_state_mask() - the state is then
+  // saved by "xsaveopt" (or "xsavec") instead.
+  //
+  // If HVPP_LAZY_FP_STATE is defined, only XMM0-XMM15 and MXCSR are saved
+  // here - x87/MMX registers aren't used by the compiler in 64-bit mode
+  // at all.  Note that even though XMM6-XMM15 are non-volatile in the x64
+  // calling convention, they must be saved here as well: fp_state_save()
+  // might be called deep in the handler's call stack (where XMM6-XMM15
+  // already hold values of the caller frames) and guest_resume() jumps
+  // back via resume_context_, which doesn't restore XMM registers at all.
+  // The full "fxsave" (512 bytes) is then performed only if the handler
+  // asks for it (see fp_state_save()).  Cycles saved this way
+  // are reflected in tsc_delta_previous()/tsc_delta_sum().  Note that upper
+  // halves of YMM registers aren't covered by this - handlers compiled with
+  // AVX support should set fp_state_eager().
+  //
+#ifdef HVPP_LAZY_FP_STATE
+  ia32_asm_xmm_save(&xmm_area_);
+#endif
+
+  fp_state_saved_ = false;
+
+  if (fp_state_eager_)
+  {
+    fp_state_save();
+  }
 
   {
     //
@@ -805,8 +1255,20 @@ void vcpu_t::entry_host() noexcept
       stack_.machine_frame.rip = context_.rip + exit_instruction_length();
       stack_.machine_frame.rsp = context_.rsp;
 
-      if (!resume_context_.capture())
+      //
+      // If guest-resume is disabled, resume_context_ isn't captured at all
+      // (and the "else" branch is never taken).
+      //
+      if (!resume_context_enabled_ || !resume_context_.capture())
       {
+        //
+        // Process requests posted by other VCPUs (if any).
+        //
+        if (request_pending_.load(std::memory_order_relaxed))
+        {
+          request_process();
+        }
+
         handler_.handle(*this);
 
         if (state_ != state::terminated)
@@ -857,12 +1319,41 @@ void vcpu_t::entry_host() noexcept
   }
 
 exit:
-  ia32_asm_fx_restore(&fxsave_area_);
+  fp_state_restore();
+
+#ifdef HVPP_LAZY_FP_STATE
+  //
+  // The state saved by fp_state_save() might already contain XMM
+  // registers clobbered by the handler - restore them (and MXCSR) last.
+  //
+  ia32_asm_xmm_restore(&xmm_area_);
+#endif
 
   tsc_delta_previous_ = ia32_asm_read_tsc() - tsc_entry_;
   tsc_delta_sum_ += tsc_delta_previous_;
 }
 
+void vcpu_t::fp_state_restore() noexcept
+{
+  if (!fp_state_saved_)
+  {
+    return;
+  }
+
+  //
+  // XRSTOR recognizes the compacted format (written by XSAVEC)
+  // by XCOMP_BV[63] in the XSAVE header.
+  //
+  if (xsave_mask_saved_ == xsave_component::legacy)
+  {
+    ia32_asm_fx_restore(&fxsave_area_);
+  }
+  else
+  {
+    ia32_asm_xrstor(xsave_area_, xsave_mask_saved_);
+  }
+}
+
 void vcpu_t::entry_guest() noexcept
 {
   // hvpp_assert(state_ == state::initializing);
@@ -1,4 +1,5 @@
 #pragma once
+#include "cpuid_cache.h"
 #include "ept.h"
 #include "interrupt.h"
 
@@ -6,12 +7,15 @@
 
 #include "lib/deque.h"
 #include "lib/error.h"
+#include "lib/mpsc_queue.h"
 #include "lib/spinlock.h"
 
 #include "lib/mm/memory_mapper.h"
 #include "lib/mm/memory_translator.h"
 
+#include <atomic>
 #include <cstdint>
+#include <mutex>
 
 namespace hvpp {
 
@@ -48,27 +52,103 @@ class vcpu_t final
     // Guest helper methods.
     //
 
-    [[noreturn]]
+    //
+    // Abandon the VM-exit handler and resume the guest.  Doesn't return,
+    // unless guest-resume is disabled (see guest_resume_disable()) - in
+    // that case there's no context to return to, the error is logged
+    // and the method returns to the caller.
+    //
     void guest_resume() noexcept;
 
+    //
+    // Capturing of the context for guest_resume() (and for unlocking of
+    // the stacked lock guards) costs full register save on each VM-exit.
+    // Handlers which never call guest_resume() and never use stacked
+    // lock guards can disable it (e.g. in vmexit_handler::setup()).
+    //
+    void guest_resume_enable() noexcept;
+    void guest_resume_disable() noexcept;
+    bool guest_resume_is_enabled() const noexcept;
+
+    //
+    // Fast VM-exits.
+    //
+    // VM-exits caused by CPUID, RDTSC, RDTSCP and XSETBV can be handled
+    // directly in vcpu.asm (see vcpu_t::entry_host_fast_()) - the
+    // instruction is simply executed on behalf of the guest, without
+    // entering the VM-exit handler.  The handler can enable them (e.g.
+    // in its setup() method) if it would just pass them through anyway.
+    // They can be disabled again at any time (on this VCPU).
+    //
+    // Note that fast VM-exits are not seen by any VM-exit handler (e.g.
+    // by vmexit_stats_handler), nor by the cpuid_cache_t.
+    //
+    // Must be called in VMX-root mode of this VCPU.
+    //
+    auto fast_exit_enable(vmx::exit_reason exit_reason) noexcept -> error_code_t;
+    void fast_exit_disable(vmx::exit_reason exit_reason) noexcept;
+    bool fast_exit_is_enabled(vmx::exit_reason exit_reason) const noexcept;
+
+    auto guest_cpuid_cache() noexcept -> cpuid_cache_t&;
+
     auto guest_memory_mapper() noexcept -> mm::memory_mapper&;
     auto guest_memory_translator() noexcept -> mm::memory_translator&;
 
+    auto guest_kernel_cr3() noexcept -> cr3_t;
     auto guest_va_to_pa(va_t guest_va) noexcept -> pa_t;
     auto guest_read_memory(va_t guest_va, void* buffer, size_t size, bool ignore_errors = false) noexcept -> va_t;
+    auto guest_read_memory_batch(mm::memory_translator::batch_entry_t* entry_list, size_t count, bool ignore_errors = false) noexcept -> size_t;
     auto guest_write_memory(va_t guest_va, const void* buffer, size_t size, bool ignore_errors = false) noexcept -> va_t;
 
     auto tsc_entry() const noexcept -> uint64_t;
     auto tsc_delta_previous() const noexcept -> uint64_t;
     auto tsc_delta_sum() const noexcept -> uint64_t;
 
+    //
+    // x87/SSE state of the interrupted code.
+    //
+    // Handler must call fp_state_save() before it executes code which
+    // might use x87/SSE/MMX registers (other than compiler-generated
+    // code, which touches only XMM registers) - unless the state is
+    // saved eagerly.  The state is restored at the end of the VM-exit.
+    // Without HVPP_LAZY_FP_STATE, the state is always saved eagerly.
+    //
+    void fp_state_save() noexcept;
+    bool fp_state_is_saved() const noexcept;
+    void fp_state_eager(bool value) noexcept;
+    bool fp_state_eager() const noexcept;
+
+    //
+    // State-components (see xsave_component) saved by fp_state_save().
+    // If the mask contains anything beyond x87 and SSE state, XSAVEOPT
+    // (or XSAVEC, or XSAVE - whichever is supported) is used instead of
+    // FXSAVE.  This is required if the handlers are compiled with AVX
+    // support.  Components not enabled in XCR0 are ignored.
+    //
+    // Returns error if the CPU (or OS) doesn't support XSAVE.
+    //
+    auto fp_state_mask(uint64_t mask) noexcept -> error_code_t;
+    auto fp_state_mask() const noexcept -> uint64_t;
+
     //
     // Stacked lock guard.
     //
 
+    //
+    // Any lock with lock()/unlock() methods can be used (spinlock,
+    // ticket_spinlock, mcs_spinlock, ...).  Shared variant acquires
+    // the lock via lock_shared()/unlock_shared() (rw_spinlock).
+    //
+
     struct stacked_lock_guard_t
     {
-      stacked_lock_guard_t(vcpu_t& vp, spinlock& lock) noexcept;
+      template <typename TLock>
+      stacked_lock_guard_t(vcpu_t& vp, TLock& lock) noexcept;
+
+      //
+      // Lock is already pushed on the stack.
+      //
+      stacked_lock_guard_t(vcpu_t& vp, std::adopt_lock_t) noexcept;
       ~stacked_lock_guard_t() noexcept;
 
       stacked_lock_guard_t(const stacked_lock_guard_t& other) noexcept = delete;
@@ -80,10 +160,87 @@ class vcpu_t final
       vcpu_t& vp_;
     };
 
-    auto stacked_lock_guard(spinlock& lock) noexcept -> stacked_lock_guard_t;
-    void stacked_lock_guard_push(spinlock& lock) noexcept;
+    template <typename TLock>
+    auto stacked_lock_guard(TLock& lock) noexcept -> stacked_lock_guard_t;
+
+    template <typename TLock>
+    auto stacked_shared_lock_guard(TLock& lock) noexcept -> stacked_lock_guard_t;
+
+    template <typename TLock>
+    void stacked_lock_guard_push(TLock& lock) noexcept;
+
+    template <typename TLock>
+    void stacked_shared_lock_guard_push(TLock& lock) noexcept;
+
     void stacked_lock_guard_pop() noexcept;
 
+    //
+    // Cross-VCPU requests.
+    //
+    // Requests can be posted to any VCPU from any CPU - including
+    // VMX-root mode of other VCPUs (the queue is lock-free, see
+    // mpsc_queue).  Pending requests are processed in a batch on the
+    // next VM-exit of the target VCPU (before the VM-exit handler is
+    // called), or explicitly by request_process().  While there are
+    // pending requests, fast VM-exits (see fast_exit_enable()) take
+    // the slow path, so that any VM-exit processes them.
+    // See also hypervisor::request_post_all() and hypervisor::kick().
+    //
+    // The batch is deduplicated before it's executed:
+    //   - callbacks are called in the order in which they've been
+    //     posted - only consecutive identical callbacks (same function,
+    //     context and arguments) are collapsed into one call (callbacks
+    //     may depend on each other - e.g. apply, remove, apply),
+    //   - each EPT pointer is invalidated only once - or all of them are
+    //     replaced by single all-context INVEPT, if any request asks for
+    //     it (or if the queue has overflowed),
+    //   - callbacks are called before the invalidation.
+    //
+
+    struct request_t
+    {
+      enum class type_t : uint32_t
+      {
+        invept_single_context,
+        invept_all_contexts,
+        callback,
+      };
+
+      using callback_fn_t = void(*)(vcpu_t& vp, const request_t& request) noexcept;
+
+      //
+      // Callback arguments are copied into the request - unlike the
+      // context, they can't be changed by anyone before the request is
+      // processed.
+      //
+      static constexpr size_t argument_count = 2;
+
+      type_t        type;
+      ept_ptr_t     ept_pointer;                // invept_single_context
+      callback_fn_t callback;                   // callback
+      void*         context;                    // callback
+      uint64_t      argument[argument_count];   // callback
+
+      static request_t invept(ept_ptr_t ept_pointer) noexcept
+      { return request_t{ type_t::invept_single_context, ept_pointer, nullptr, nullptr, {} }; }
+
+      static request_t invept_all() noexcept
+      { return request_t{ type_t::invept_all_contexts, ept_ptr_t{}, nullptr, nullptr, {} }; }
+
+      static request_t call(callback_fn_t callback, void* context, uint64_t argument0 = 0, uint64_t argument1 = 0) noexcept
+      { return request_t{ type_t::callback, ept_ptr_t{}, callback, context, { argument0, argument1 } }; }
+    };
+
+    static constexpr size_t request_queue_size = 32;
+
+    //
+    // INVEPT requests can't fail - if the queue is full, all-context
+    // INVEPT is performed instead.  Returns false if the callback
+    // couldn't be queued.
+    //
+    bool request_post(const request_t& request) noexcept;
+    void request_process() noexcept;
+
     //
     // VMCS manipulation. Implementation is in vcpu.inl.
     //
@@ -320,8 +477,21 @@ class vcpu_t final
     void entry_guest() noexcept;
 
     static void entry_host_() noexcept;
+    static void entry_host_fast_() noexcept;
     static void entry_guest_() noexcept;
 
+    void fast_exit_mask(uint64_t mask) noexcept;
+
+    void fp_state_restore() noexcept;
+
+    enum class xsave_instruction : uint8_t
+    {
+      none,       // XSAVE not supported, FXSAVE is used.
+      xsave,
+      xsaveopt,   // Init and modified optimization.
+      xsavec,     // Init optimization, compacted format.
+    };
+
     enum class state
     {
       //
@@ -395,14 +565,26 @@ class vcpu_t final
       };
     };
 
-    using spinlock_queue_t = fixed_dequeue<spinlock*, 32>;
+    //
+    // Locked lock and function which unlocks it.
+    //
+    struct stacked_lock_t
+    {
+      void* lock;
+      void (*unlock)(void* lock) noexcept;
+    };
+
+    using spinlock_queue_t = fixed_dequeue<stacked_lock_t, 32>;
+
+    using request_queue_t = mpsc_queue<request_t, request_queue_size>;
 
     static_assert(sizeof(stack_t) == stack_t::size);
     static_assert(sizeof(stack_t::shadow_space_t) == 32);
 
     //
-    // If you reorder following three members (stack, exit context
-    // and launch context), you have to edit offsets in vcpu.asm.
+    // If you reorder following five members (stack, exit context,
+    // launch context, fast exit mask and request pending flag), you
+    // have to edit offsets in vcpu.asm.
     //
     stack_t               stack_;
 
@@ -416,6 +598,17 @@ class vcpu_t final
       context_t           launch_context_;
     };
 
+    //
+    // Bitmap of exit reasons handled in vcpu_t::entry_host_fast_().
+    //
+    uint64_t              fast_exit_mask_;
+
+    //
+    // Set if there are pending cross-VCPU requests (see request_post()).
+    // Fast VM-exits take the slow path if it's set.
+    //
+    std::atomic<bool>     request_pending_;
+
     //
     // Various VMX structures.
     // Keep in mind they have "alignas(PAGE_SIZE)" specifier.
@@ -429,6 +622,20 @@ class vcpu_t final
     // FXSAVE area - to keep SSE registers sane between VM-exits.
     //
     fxsave_area_t         fxsave_area_;
+    xmm_area_t            xmm_area_;
+    bool                  fp_state_saved_;
+    bool                  fp_state_eager_;
+
+    //
+    // XSAVE area - used instead of FXSAVE area if fp_state_mask() contains
+    // more than x87 and SSE state.  Its size is determined by CPUID leaf 0xD
+    // (so that it can hold all state-components supported by the CPU).
+    //
+    uint8_t*              xsave_area_;
+    uint32_t              xsave_area_size_;
+    xsave_instruction     xsave_instruction_;
+    uint64_t              xsave_mask_;
+    uint64_t              xsave_mask_saved_;
 
     vmexit_handler&       handler_;
     state                 state_;
@@ -440,6 +647,7 @@ class vcpu_t final
     //
     context_t             resume_context_;
     spinlock_queue_t      spinlock_queue_;
+    bool                  resume_context_enabled_;
 
     //
     // Memory translation support.
@@ -447,6 +655,18 @@ class vcpu_t final
     mm::memory_mapper     mapper_;
     mm::memory_translator translator_;
 
+    //
+    // Kernel CR3 of the guest (see detail::kernel_cr3()).
+    // Computed at most once per VM-exit (unless guest CR3 is changed),
+    // reset in entry_host() method.
+    //
+    cr3_t                 guest_kernel_cr3_;
+
+    //
+    // CPUID support.
+    //
+    cpuid_cache_t         cpuid_cache_;
+
     //
     // Timestamp-counter.
     //
@@ -459,9 +679,58 @@ class vcpu_t final
     //
     interrupt_queue_t     pending_interrupt_queue_[interrupt_queue_max];
 
+    //
+    // Cross-VCPU requests.
+    // Set "overflow" means that some INVEPT request has been dropped.
+    //
+    request_queue_t       request_queue_;
+    std::atomic<bool>     request_overflow_;
+
     void*                 user_data_;
 
     bool                  suppress_rip_adjust_;
 };
 
+//
+// Stacked lock guard (templates).
+//
+
+template <typename TLock>
+vcpu_t::stacked_lock_guard_t::stacked_lock_guard_t(vcpu_t& vp, TLock& lock) noexcept
+  : vp_{ vp }
+{
+  vp_.stacked_lock_guard_push(lock);
+}
+
+template <typename TLock>
+auto vcpu_t::stacked_lock_guard(TLock& lock) noexcept -> stacked_lock_guard_t
+{
+  return stacked_lock_guard_t{ *this, lock };
+}
+
+template <typename TLock>
+void vcpu_t::stacked_lock_guard_push(TLock& lock) noexcept
+{
+  lock.lock();
+  spinlock_queue_.push_back({ &lock, [](void* ptr) noexcept {
+    static_cast<TLock*>(ptr)->unlock();
+  } });
+}
+
+template <typename TLock>
+auto vcpu_t::stacked_shared_lock_guard(TLock& lock) noexcept -> stacked_lock_guard_t
+{
+  stacked_shared_lock_guard_push(lock);
+  return stacked_lock_guard_t{ *this, std::adopt_lock };
+}
+
+template <typename TLock>
+void vcpu_t::stacked_shared_lock_guard_push(TLock& lock) noexcept
+{
+  lock.lock_shared();
+  spinlock_queue_.push_back({ &lock, [](void* ptr) noexcept {
+    static_cast<TLock*>(ptr)->unlock_shared();
+  } });
+}
+
 }
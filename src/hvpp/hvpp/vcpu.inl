@@ -38,29 +38,18 @@
 
 namespace hvpp {
 
-auto vcpu_t::stacked_lock_guard(spinlock& lock) noexcept -> stacked_lock_guard_t
-{
-  return stacked_lock_guard_t{ *this, lock };
-}
-
-void vcpu_t::stacked_lock_guard_push(spinlock& lock) noexcept
-{
-  lock.lock();
-  spinlock_queue_.push_back(&lock);
-}
-
 void vcpu_t::stacked_lock_guard_pop() noexcept
 {
-  auto& lock = *spinlock_queue_.back();
+  const auto lock = spinlock_queue_.back();
   spinlock_queue_.pop_back();
 
-  lock.unlock();
+  lock.unlock(lock.lock);
 }
 
-vcpu_t::stacked_lock_guard_t::stacked_lock_guard_t(vcpu_t& vp, spinlock& lock) noexcept
+vcpu_t::stacked_lock_guard_t::stacked_lock_guard_t(vcpu_t& vp, std::adopt_lock_t) noexcept
   : vp_{ vp }
 {
-  vp_.stacked_lock_guard_push(lock);
+
 }
 
 vcpu_t::stacked_lock_guard_t::~stacked_lock_guard_t() noexcept
@@ -689,6 +678,11 @@ auto vcpu_t::guest_cr3() const noexcept -> cr3_t
 void vcpu_t::guest_cr3(cr3_t cr3) noexcept
 {
   vmx::vmwrite(vmx::vmcs_t::field::guest_cr3, cr3);
+
+  //
+  // Cached kernel CR3 is no longer valid.
+  //
+  guest_kernel_cr3_.flags = 0;
 }
 
 auto vcpu_t::guest_cr4() const noexcept -> cr4_t
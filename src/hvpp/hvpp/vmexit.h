@@ -194,7 +194,8 @@ class vmexit_handler
     // that haven't been freed by object desctructors.
     //
     // Note:
-    //   Use `auto _ = vp.stacked_lock_guard(lock)' for acquiring spinlocks.
+    //   Use `auto _ = vp.stacked_lock_guard(lock)' for acquiring spinlocks
+    //   (or `vp.stacked_shared_lock_guard(lock)' for shared access).
     //   Spinlocks that are locked this way are by always unlocked.
     //
     virtual void handle_guest_resume(vcpu_t& vp, bool was_force_resumed) noexcept;
@@ -1,7 +1,7 @@
 #pragma once
 #include "hvpp/vmexit.h"
 
-#include <atomic>
+#include "hvpp/lib/atomic_bitmap.h"
 
 namespace hvpp {
 
@@ -9,7 +9,45 @@ namespace hvpp {
 // Structure for storing on which VM-exits the debug-break
 // should be invoked.
 //
-using vmexit_dbgbreak_storage_t = vmexit_storage_t<std::atomic_bool>;
+// Layout of this structure mirrors vmexit_storage_t (see its
+// description), but each storage is a single bit instead of
+// std::atomic_bool (~20kb instead of ~160kb).
+//
+
+struct vmexit_dbgbreak_storage_t
+{
+  static constexpr size_t cpuid_0_max = 16;
+  static constexpr size_t cpuid_8_max = 16;
+
+  atomic_bitmap<65>           vmexit;
+  atomic_bitmap<256>          exception_vector;
+
+  atomic_bitmap<cpuid_0_max>  cpuid_0;
+  atomic_bitmap<cpuid_8_max>  cpuid_8;
+  atomic_bitmap<1>            cpuid_other;
+
+  atomic_bitmap<8>            mov_from_cr;
+  atomic_bitmap<8>            mov_to_cr;
+  atomic_bitmap<1>            clts;
+  atomic_bitmap<1>            lmsw;
+
+  atomic_bitmap<8>            mov_from_dr;
+  atomic_bitmap<8>            mov_to_dr;
+
+  atomic_bitmap<4>            gdtr_idtr;
+  atomic_bitmap<4>            ldtr_tr;
+
+  atomic_bitmap<0x10000>      io_in;
+  atomic_bitmap<0x10000>      io_out;
+
+  atomic_bitmap<0x2000>       rdmsr_0;
+  atomic_bitmap<0x2000>       rdmsr_c;
+  atomic_bitmap<1>            rdmsr_other;
+
+  atomic_bitmap<0x2000>       wrmsr_0;
+  atomic_bitmap<0x2000>       wrmsr_c;
+  atomic_bitmap<1>            wrmsr_other;
+};
 
 //
 // Simple handler which breaks into the debugger
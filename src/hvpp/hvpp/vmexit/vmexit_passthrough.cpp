@@ -1,3 +1,5 @@
+#define HVPP_LOG_MODULE vmexit
+
 #include "vmexit_passthrough.h"
 
 #include "hvpp/config.h"
@@ -192,10 +194,15 @@ void vmexit_passthrough_handler::handle_nmi_window(vcpu_t& vp) noexcept
 
 void vmexit_passthrough_handler::handle_execute_cpuid(vcpu_t& vp) noexcept
 {
+  //
+  // Results of invariant leaves are served from the per-VCPU cache
+  // (see cpuid_cache_t).
+  //
   uint32_t cpu_info[4];
-  ia32_asm_cpuid_ex(cpu_info,
-                    vp.context().eax,
-                    vp.context().ecx);
+  vp.guest_cpuid_cache().cpuid(cpu_info,
+                               vp.context().eax,
+                               vp.context().ecx,
+                               vp.guest_cr4());
 
   vp.context().rax = cpu_info[0];
   vp.context().rbx = cpu_info[1];
@@ -264,6 +271,11 @@ void vmexit_passthrough_handler::handle_execute_invlpg(vcpu_t& vp) noexcept
   //
 
   vmx::invvpid_individual_address(vp.vcpu_id(), linear_address);
+
+  //
+  // Invalidate translations cached by the memory translator.
+  //
+  vp.guest_memory_translator().flush(va_t{ linear_address });
 }
 
 void vmexit_passthrough_handler::handle_execute_rdtsc(vcpu_t& vp) noexcept
@@ -344,6 +356,12 @@ void vmexit_passthrough_handler::handle_mov_cr(vcpu_t& vp) noexcept
           //
           vmx::invvpid_single_context_retaining_globals(vp.vcpu_id());
 
+          //
+          // Translations cached by the memory translator don't track
+          // global pages - invalidate all of them.
+          //
+          vp.guest_memory_translator().flush();
+
           break;
         }
 
@@ -367,6 +385,7 @@ void vmexit_passthrough_handler::handle_mov_cr(vcpu_t& vp) noexcept
           if (pge_changed)
           {
             vmx::invvpid_single_context(vp.vcpu_id());
+            vp.guest_memory_translator().flush();
           }
 
           vp.guest_cr4(new_cr4);
@@ -1032,18 +1051,22 @@ void vmexit_passthrough_handler::handle_execute_invpcid(vcpu_t& vp) noexcept
       // in INVPCID_DESC[127:64] is not canonical.
       //
       vmx::invvpid_individual_address(vp.vcpu_id(), descriptor.linear_address);
+      vp.guest_memory_translator().flush(va_t{ descriptor.linear_address });
       break;
 
     case invpcid_t::single_context:
       vmx::invvpid_single_context(vp.vcpu_id());
+      vp.guest_memory_translator().flush();
       break;
 
     case invpcid_t::all_contexts:
       vmx::invvpid_single_context(vp.vcpu_id());
+      vp.guest_memory_translator().flush();
       break;
 
     case invpcid_t::all_contexts_retaining_globals:
       vmx::invvpid_single_context_retaining_globals(vp.vcpu_id());
+      vp.guest_memory_translator().flush();
       break;
   }
 
@@ -1132,16 +1155,17 @@ void vmexit_passthrough_handler::handle_interrupt(vcpu_t& vp) noexcept
 
           if (auto err_va = vp.guest_read_memory(vp.context().rip, buffer, read_size))
           {
-            hvpp_trace("handle_interrupt (invalid_opcode) - read_guest_memory(%p, %u) failed, injecting #PF",
-                       vp.context().rip,
-                       instruction_length);
+            hvpp_trace_ratelimited("handle_interrupt (invalid_opcode) - read_guest_memory(%p, %u) failed, injecting #PF",
+                                   vp.context().rip,
+                                   instruction_length);
 
             write<cr2_t>({ err_va.value() });
             vp.interrupt_inject(interrupt::page_fault);
             vp.suppress_rip_adjust();
 
             //
-            // `vp.guest_resume()' can be also used instead of `return'.
+            // `vp.guest_resume()' can be also used instead of `return'
+            // (if guest-resume is enabled).
             //
 
             return;
@@ -1178,16 +1202,17 @@ void vmexit_passthrough_handler::handle_interrupt(vcpu_t& vp) noexcept
 
           if (auto err_va = vp.guest_read_memory(vp.context().rip, buffer, read_size))
           {
-            hvpp_trace("handle_interrupt (general_protection) - read_guest_memory(%p, %u) failed, injecting #PF",
-                       vp.context().rip,
-                       instruction_length);
+            hvpp_trace_ratelimited("handle_interrupt (general_protection) - read_guest_memory(%p, %u) failed, injecting #PF",
+                                   vp.context().rip,
+                                   instruction_length);
 
             write<cr2_t>({ err_va.value() });
             vp.interrupt_inject(interrupt::page_fault);
             vp.suppress_rip_adjust();
 
             //
-            // `vp.guest_resume()' can be also used instead of `return'.
+            // `vp.guest_resume()' can be also used instead of `return'
+            // (if guest-resume is enabled).
             //
 
             return;
@@ -1,3 +1,5 @@
+#define HVPP_LOG_MODULE vmexit
+
 #include "vmexit_stats.h"
 
 #include "hvpp/vcpu.h"
@@ -6,7 +8,9 @@
 #include "hvpp/lib/log.h"
 #include "hvpp/lib/mp.h"  // mp::cpu_index()
 
+#include <algorithm>      // std::sort()
 #include <iterator>       // std::size()
+#include <mutex>          // std::lock_guard
 
 #define hvpp_trace_if_enabled(format, ...)                        \
   do                                                              \
@@ -19,19 +23,54 @@
 
 namespace hvpp {
 
+namespace detail
+{
+  //
+  // Call "fn" for each entry of the sparse counter, ordered by key.
+  //
+  template <
+    typename T,
+    size_t CAPACITY,
+    typename FN
+  >
+  void sparse_counter_sorted_for_each(const vmexit_sparse_counter_t<T, CAPACITY>& counter, FN fn) noexcept
+  {
+    using entry_t = typename vmexit_sparse_counter_t<T, CAPACITY>::entry_t;
+
+    std::array<entry_t, CAPACITY> entries;
+    size_t entry_count = 0;
+
+    counter.for_each([&](uint32_t key, T value) {
+      entries[entry_count++] = entry_t{ key, value };
+    });
+
+    std::sort(entries.begin(), entries.begin() + entry_count,
+      [](const entry_t& lhs, const entry_t& rhs) {
+        return lhs.key < rhs.key;
+      });
+
+    for (size_t i = 0; i < entry_count; ++i)
+    {
+      fn(entries[i].key, entries[i].value);
+    }
+  }
+}
+
 vmexit_stats_handler::vmexit_stats_handler() noexcept
   : storage_merged_{}
+  , storage_scratch_{}
+  , storage_previous_{}
+  , snapshot_id_{}
+  , snapshot_timestamp_{}
+  , snapshot_lock_{ "vmexit_stats_handler::snapshot" }
   , vmexit_trace_bitmap_{}
 {
   terminated_vcpu_count_ = 0;
 
   //
-  // Allocate memory for statistics (per VCPU).
+  // Sample every VM-exit by default.
   //
-  storage_ = new vmexit_stats_storage_t[mp::cpu_count()];
-  hvpp_assert(storage_ != nullptr);
-
-  memset(storage_, 0, sizeof(*storage_) * mp::cpu_count());
+  sample_rate_.fill(1);
 
   //
   // Uncomment this to trace all VM-exit reasons.
@@ -45,23 +84,97 @@ vmexit_stats_handler::vmexit_stats_handler() noexcept
   //
   // vmexit_trace_bitmap_.clear(int(vmx::exit_reason::exception_or_nmi));
   //
+  // Example of collecting detailed statistics (and trace) only
+  // for 1 in 64 "rdmsr" VM-exits:
+  //
+  // sample_rate(vmx::exit_reason::execute_rdmsr, 64);
+  //
 }
 
 vmexit_stats_handler::~vmexit_stats_handler() noexcept
 {
   //
-  // Free the memory.
+  // Per-CPU slot is released by percpu::destroy().
   //
-  delete[] storage_;
+}
+
+auto vmexit_stats_handler::setup(vcpu_t& vp) noexcept -> error_code_t
+{
+  (void)(vp);
+
+  //
+  // Reserve per-CPU slot for statistics.  The slot is zeroed.
+  // It's reserved only by the first VCPU which gets here - the failure
+  // is returned to each of them, so that the hypervisor doesn't start
+  // (handle() writes into the slot unconditionally).
+  //
+  return storage_.initialize();
 }
 
 void vmexit_stats_handler::handle(vcpu_t& vp) noexcept
 {
   const auto  exit_reason = vp.exit_reason();
-        auto& stats       = storage_[mp::cpu_index()];
+        auto& cpu_storage = storage_.get();
+        auto& stats       = cpu_storage.storage;
+
+  //
+  // Make the sequence odd - readers (see storage_read()) will
+  // know that the statistics are being updated.
+  // Only this VCPU writes to its sequence, therefore simple
+  // load + store is sufficient.
+  //
+  const auto sequence = cpu_storage.sequence.load(std::memory_order_relaxed);
+  cpu_storage.sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
 
   stats.vmexit[static_cast<int>(exit_reason)] += 1;
 
+  //
+  // Detailed statistics and tracing are performed only for
+  // 1 in N VM-exits (N is configured by sample_rate()).
+  // Every VM-exit is counted in stats.vmexit[] regardless.
+  //
+  auto& sample_countdown = cpu_storage.sample_countdown[static_cast<int>(exit_reason)];
+
+  if (sample_countdown > 1)
+  {
+    sample_countdown -= 1;
+  }
+  else
+  {
+    sample_countdown = sample_rate_[static_cast<int>(exit_reason)];
+
+    stats.vmexit_sampled[static_cast<int>(exit_reason)] += 1;
+    handle_sampled(vp, stats);
+  }
+
+  //
+  // Make the sequence even again.
+  //
+  cpu_storage.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+void vmexit_stats_handler::sample_rate(vmx::exit_reason exit_reason, uint32_t rate) noexcept
+{
+  hvpp_assert(static_cast<size_t>(exit_reason) < std::size(sample_rate_));
+
+  //
+  // Rate 0 is treated as 1 (i.e. sample every VM-exit).
+  //
+  sample_rate_[static_cast<int>(exit_reason)] = rate ? rate : 1;
+}
+
+uint32_t vmexit_stats_handler::sample_rate(vmx::exit_reason exit_reason) const noexcept
+{
+  hvpp_assert(static_cast<size_t>(exit_reason) < std::size(sample_rate_));
+
+  return sample_rate_[static_cast<int>(exit_reason)];
+}
+
+void vmexit_stats_handler::handle_sampled(vcpu_t& vp, vmexit_stats_storage_t& stats) noexcept
+{
+  const auto exit_reason = vp.exit_reason();
+
   switch (exit_reason)
   {
     case vmx::exit_reason::exception_or_nmi:
@@ -71,7 +184,7 @@ void vmexit_stats_handler::handle(vcpu_t& vp) noexcept
       break;
 
     case vmx::exit_reason::external_interrupt:
-      stats.exception_vector[static_cast<int>(vp.interrupt_info().vector())] += 1;
+      stats.interrupt_vector[static_cast<int>(vp.interrupt_info().vector())] += 1;
 
       hvpp_trace_if_enabled("exit_reason::external_interrupt: %s", to_string(vp.interrupt_info().vector()));
       break;
@@ -176,7 +289,7 @@ void vmexit_stats_handler::handle(vcpu_t& vp) noexcept
       switch (vp.exit_qualification().io_instruction.access_type)
       {
         case vmx::exit_qualification_io_instruction_t::access_out:
-          stats.io_out[vp.exit_qualification().io_instruction.port_number] += 1;
+          stats.io_out.add(vp.exit_qualification().io_instruction.port_number);
 
           hvpp_trace_if_enabled(
             "exit_reason::execute_io_instruction: out 0x%04x",
@@ -184,7 +297,7 @@ void vmexit_stats_handler::handle(vcpu_t& vp) noexcept
           break;
 
         case vmx::exit_qualification_io_instruction_t::access_in:
-          stats.io_in[vp.exit_qualification().io_instruction.port_number] += 1;
+          stats.io_in.add(vp.exit_qualification().io_instruction.port_number);
 
           hvpp_trace_if_enabled(
             "exit_reason::execute_io_instruction: in 0x%04x",
@@ -194,36 +307,12 @@ void vmexit_stats_handler::handle(vcpu_t& vp) noexcept
       break;
 
     case vmx::exit_reason::execute_rdmsr:
-      if (vp.context().ecx <= 0x0000'1fffu)
-      {
-        stats.rdmsr_0[vp.context().ecx] += 1;
-      }
-      else if (vp.context().ecx >= 0xc000'0000u &&
-               vp.context().ecx <= 0xc000'1fffu)
-      {
-        stats.rdmsr_c[vp.context().ecx - 0xc000'0000u] += 1;
-      }
-      else
-      {
-        stats.rdmsr_other += 1;
-      }
+      stats.rdmsr.add(vp.context().ecx);
       hvpp_trace_if_enabled("exit_reason::execute_rdmsr: 0x%08x", vp.context().ecx);
       break;
 
     case vmx::exit_reason::execute_wrmsr:
-      if (vp.context().ecx <= 0x0000'1fffu)
-      {
-        stats.wrmsr_0[vp.context().ecx] += 1;
-      }
-      else if (vp.context().ecx >= 0xc000'0000u &&
-               vp.context().ecx <= 0xc000'1fffu)
-      {
-        stats.wrmsr_c[vp.context().ecx - 0xc000'0000u] += 1;
-      }
-      else
-      {
-        stats.wrmsr_other += 1;
-      }
+      stats.wrmsr.add(vp.context().ecx);
 
       hvpp_trace_if_enabled("exit_reason::execute_wrmsr: 0x%08x", vp.context().ecx);
       break;
@@ -272,6 +361,8 @@ void vmexit_stats_handler::handle(vcpu_t& vp) noexcept
 
 void vmexit_stats_handler::dump() noexcept
 {
+  std::lock_guard _{ snapshot_lock_ };
+
   //
   // Reset values.
   //
@@ -279,12 +370,29 @@ void vmexit_stats_handler::dump() noexcept
 
   //
   // Handler saves statistics separately for each VCPU.
-  // We merge statistics from all VCPUs into the first
-  // one (index 0).
+  // We merge statistics from all VCPUs into the
+  // storage_merged_.
   //
+  uint32_t torn_cpu_count = 0;
+
   for (uint32_t i = 0; i < mp::cpu_count(); ++i)
   {
-    storage_merge(storage_merged_, storage_[i]);
+    if (!mp::cpu_is_active(i))
+    {
+      continue;
+    }
+
+    if (!storage_read(i, storage_scratch_))
+    {
+      torn_cpu_count += 1;
+    }
+
+    storage_merge(storage_merged_, storage_scratch_);
+  }
+
+  if (torn_cpu_count)
+  {
+    hvpp_warn("Statistics of %u VCPU(s) might be inconsistent", torn_cpu_count);
   }
 
   //
@@ -292,6 +400,103 @@ void vmexit_stats_handler::dump() noexcept
   // This is sum of statistics for each VCPU.
   //
   storage_dump(storage_merged_);
+
+  //
+  // Print statistics of instrumented spinlocks (if enabled).
+  //
+  spinlock_stats::dump();
+}
+
+void vmexit_stats_handler::snapshot(vmexit_stats_snapshot_t& result) noexcept
+{
+  std::lock_guard _{ snapshot_lock_ };
+
+  memset(&result, 0, sizeof(result));
+
+  //
+  // Merge statistics of all VCPUs.  Each VCPU is read separately
+  // (and consistently), VCPUs aren't stopped while we're reading
+  // their statistics.
+  //
+  for (uint32_t i = 0; i < mp::cpu_count(); ++i)
+  {
+    if (!mp::cpu_is_active(i))
+    {
+      continue;
+    }
+
+    if (!storage_read(i, storage_scratch_))
+    {
+      result.torn_cpu_count += 1;
+    }
+
+    storage_merge(result.total, storage_scratch_);
+  }
+
+  storage_delta(result.delta, result.total, storage_previous_);
+
+  result.snapshot_id        = ++snapshot_id_;
+  result.timestamp          = ia32_asm_read_tsc();
+  result.timestamp_previous = snapshot_timestamp_;
+
+  //
+  // Remember this snapshot, so that the next one can compute delta.
+  //
+  memcpy(&storage_previous_, &result.total, sizeof(storage_previous_));
+  snapshot_timestamp_ = result.timestamp;
+}
+
+bool vmexit_stats_handler::storage_read(uint32_t cpu_index, vmexit_stats_storage_t& result) const noexcept
+{
+  //
+  // Nothing has been collected yet if the hypervisor hasn't been
+  // started (i.e. setup() hasn't been called).
+  //
+  if (!storage_.is_initialized())
+  {
+    memset(&result, 0, sizeof(result));
+    return true;
+  }
+
+  const auto& cpu_storage = storage_.get(cpu_index);
+
+  //
+  // The retry count is bounded - this is called with snapshot_lock_
+  // held and VCPU which exits in a tight loop could otherwise keep
+  // us here indefinitely.
+  //
+  for (uint32_t retry = 0; retry < storage_read_retry_max; ++retry)
+  {
+    const auto sequence = cpu_storage.sequence.load(std::memory_order_acquire);
+
+    //
+    // VCPU is in the middle of the update - wait until it's done.
+    //
+    if (sequence & 1)
+    {
+      ia32_asm_pause();
+      continue;
+    }
+
+    memcpy(&result, &cpu_storage.storage, sizeof(result));
+    std::atomic_thread_fence(std::memory_order_acquire);
+
+    //
+    // If the sequence didn't change, VCPU didn't touch
+    // its statistics during the copy.
+    //
+    if (cpu_storage.sequence.load(std::memory_order_relaxed) == sequence)
+    {
+      return true;
+    }
+  }
+
+  //
+  // Give up and take whatever is there - the caller reports
+  // the copy as torn.
+  //
+  memcpy(&result, &cpu_storage.storage, sizeof(result));
+  return false;
 }
 
 void vmexit_stats_handler::storage_merge(vmexit_stats_storage_t& lhs, const vmexit_stats_storage_t& rhs) const noexcept
@@ -303,7 +508,9 @@ void vmexit_stats_handler::storage_merge(vmexit_stats_storage_t& lhs, const vmex
   }
 
   STORAGE_MERGE_IMPL(vmexit);
+  STORAGE_MERGE_IMPL(vmexit_sampled);
   STORAGE_MERGE_IMPL(exception_vector);
+  STORAGE_MERGE_IMPL(interrupt_vector);
   STORAGE_MERGE_IMPL(cpuid_0);
   STORAGE_MERGE_IMPL(cpuid_8);
   lhs.cpuid_other += rhs.cpuid_other;
@@ -315,18 +522,56 @@ void vmexit_stats_handler::storage_merge(vmexit_stats_storage_t& lhs, const vmex
   STORAGE_MERGE_IMPL(mov_to_dr);
   STORAGE_MERGE_IMPL(gdtr_idtr);
   STORAGE_MERGE_IMPL(ldtr_tr);
-  STORAGE_MERGE_IMPL(io_in);
-  STORAGE_MERGE_IMPL(io_out);
-  STORAGE_MERGE_IMPL(rdmsr_0);
-  STORAGE_MERGE_IMPL(rdmsr_c);
-  lhs.rdmsr_other += rhs.rdmsr_other;
-  STORAGE_MERGE_IMPL(wrmsr_0);
-  STORAGE_MERGE_IMPL(wrmsr_c);
-  lhs.wrmsr_other += rhs.wrmsr_other;
+
+  //
+  // Sparse counters are merged entry-by-entry - cost of the merge
+  // depends only on count of distinct keys, not on key range.
+  //
+  lhs.io_in.merge(rhs.io_in);
+  lhs.io_out.merge(rhs.io_out);
+  lhs.rdmsr.merge(rhs.rdmsr);
+  lhs.wrmsr.merge(rhs.wrmsr);
 
 #undef STORAGE_MERGE_IMPL
 }
 
+void vmexit_stats_handler::storage_delta(vmexit_stats_storage_t& result, const vmexit_stats_storage_t& lhs, const vmexit_stats_storage_t& rhs) const noexcept
+{
+#define STORAGE_DELTA_IMPL(name)                        \
+  for (uint32_t i = 0; i < std::size(result.name); ++i) \
+  {                                                     \
+    result.name[i] = lhs.name[i] - rhs.name[i];         \
+  }
+
+  STORAGE_DELTA_IMPL(vmexit);
+  STORAGE_DELTA_IMPL(vmexit_sampled);
+  STORAGE_DELTA_IMPL(exception_vector);
+  STORAGE_DELTA_IMPL(interrupt_vector);
+  STORAGE_DELTA_IMPL(cpuid_0);
+  STORAGE_DELTA_IMPL(cpuid_8);
+  result.cpuid_other = lhs.cpuid_other - rhs.cpuid_other;
+  STORAGE_DELTA_IMPL(mov_from_cr);
+  STORAGE_DELTA_IMPL(mov_to_cr);
+  result.clts = lhs.clts - rhs.clts;
+  result.lmsw = lhs.lmsw - rhs.lmsw;
+  STORAGE_DELTA_IMPL(mov_from_dr);
+  STORAGE_DELTA_IMPL(mov_to_dr);
+  STORAGE_DELTA_IMPL(gdtr_idtr);
+  STORAGE_DELTA_IMPL(ldtr_tr);
+
+  //
+  // Sparse counters can't be simply subtracted - zero-valued entry
+  // means "empty slot".  Therefore "result" is expected to be empty
+  // here and only non-zero differences are inserted.
+  //
+  result.io_in.merge_delta(lhs.io_in, rhs.io_in);
+  result.io_out.merge_delta(lhs.io_out, rhs.io_out);
+  result.rdmsr.merge_delta(lhs.rdmsr, rhs.rdmsr);
+  result.wrmsr.merge_delta(lhs.wrmsr, rhs.wrmsr);
+
+#undef STORAGE_DELTA_IMPL
+}
+
 void vmexit_stats_handler::storage_dump(const vmexit_stats_storage_t& storage_to_dump) const noexcept
 {
   const auto& stats = storage_to_dump;
@@ -336,9 +581,35 @@ void vmexit_stats_handler::storage_dump(const vmexit_stats_storage_t& storage_to
   {
     if (stats.vmexit[exit_reason_index] > 0)
     {
-      hvpp_info("  %s: %u",
-        vmx::to_string(static_cast<vmx::exit_reason>(exit_reason_index)),
-        stats.vmexit[exit_reason_index]);
+      const auto total   = stats.vmexit[exit_reason_index];
+      const auto sampled = stats.vmexit_sampled[exit_reason_index];
+
+      //
+      // If the VM-exit reason has been sampled, detailed statistics
+      // are scaled by "total / sampled" ratio - i.e. they're just
+      // estimates.
+      //
+      const auto estimate = [total, sampled](uint32_t value) noexcept -> uint32_t {
+        return sampled && sampled != total
+          ? static_cast<uint32_t>(uint64_t(value) * total / sampled)
+          : value;
+      };
+
+      (void)(estimate);
+
+      if (sampled == total)
+      {
+        hvpp_info("  %s: %u",
+          vmx::to_string(static_cast<vmx::exit_reason>(exit_reason_index)),
+          total);
+      }
+      else
+      {
+        hvpp_info("  %s: %u (sampled: %u, breakdown is estimated)",
+          vmx::to_string(static_cast<vmx::exit_reason>(exit_reason_index)),
+          total,
+          sampled);
+      }
 
       switch (static_cast<vmx::exit_reason>(exit_reason_index))
       {
@@ -349,19 +620,19 @@ void vmexit_stats_handler::storage_dump(const vmexit_stats_storage_t& storage_to
             (void)(exception_vector_string);
             if (stats.exception_vector[i] > 0)
             {
-              hvpp_info("    %s: %u", exception_vector_string, stats.exception_vector[i]);
+              hvpp_info("    %s: %u", exception_vector_string, estimate(stats.exception_vector[i]));
             }
           }
           break;
 
         case vmx::exit_reason::external_interrupt:
-          for (uint32_t i = 0; i < std::size(stats.exception_vector); ++i)
+          for (uint32_t i = 0; i < std::size(stats.interrupt_vector); ++i)
           {
             const char* exception_vector_string = to_string(static_cast<exception_vector>(i));
             (void)(exception_vector_string);
-            if (stats.exception_vector[i] > 0)
+            if (stats.interrupt_vector[i] > 0)
             {
-              hvpp_info("    %s: %u", exception_vector_string, stats.exception_vector[i]);
+              hvpp_info("    %s: %u", exception_vector_string, estimate(stats.interrupt_vector[i]));
             }
           }
           break;
@@ -371,7 +642,7 @@ void vmexit_stats_handler::storage_dump(const vmexit_stats_storage_t& storage_to
           {
             if (stats.cpuid_0[i] > 0)
             {
-              hvpp_info("    0x%08x: %u", i, stats.cpuid_0[i]);
+              hvpp_info("    0x%08x: %u", i, estimate(stats.cpuid_0[i]));
             }
           }
 
@@ -379,13 +650,13 @@ void vmexit_stats_handler::storage_dump(const vmexit_stats_storage_t& storage_to
           {
             if (stats.cpuid_8[i] > 0)
             {
-              hvpp_info("    0x%08x: %u", i + 0x8000'0000u, stats.cpuid_8[i]);
+              hvpp_info("    0x%08x: %u", i + 0x8000'0000u, estimate(stats.cpuid_8[i]));
             }
           }
 
           if (stats.cpuid_other > 0)
           {
-            hvpp_info("    0x(OTHER): %u", stats.cpuid_other);
+            hvpp_info("    0x(OTHER): %u", estimate(stats.cpuid_other));
           }
           break;
 
@@ -394,7 +665,7 @@ void vmexit_stats_handler::storage_dump(const vmexit_stats_storage_t& storage_to
           {
             if (stats.mov_from_cr[i] > 0)
             {
-              hvpp_info("    mov_from_cr[%i]: %u", i, stats.mov_from_cr[i]);
+              hvpp_info("    mov_from_cr[%i]: %u", i, estimate(stats.mov_from_cr[i]));
             }
           }
 
@@ -402,18 +673,18 @@ void vmexit_stats_handler::storage_dump(const vmexit_stats_storage_t& storage_to
           {
             if (stats.mov_to_cr[i] > 0)
             {
-              hvpp_info("    mov_to_cr[%i]: %u", i, stats.mov_to_cr[i]);
+              hvpp_info("    mov_to_cr[%i]: %u", i, estimate(stats.mov_to_cr[i]));
             }
           }
 
           if (stats.clts > 0)
           {
-            hvpp_info("    clts: %u", stats.clts);
+            hvpp_info("    clts: %u", estimate(stats.clts));
           }
 
           if (stats.lmsw > 0)
           {
-            hvpp_info("    lmsw: %u", stats.lmsw);
+            hvpp_info("    lmsw: %u", estimate(stats.lmsw));
           }
           break;
 
@@ -422,7 +693,7 @@ void vmexit_stats_handler::storage_dump(const vmexit_stats_storage_t& storage_to
           {
             if (stats.mov_from_dr[i] > 0)
             {
-              hvpp_info("    mov_from_dr[%i]: %u", i, stats.mov_from_dr[i]);
+              hvpp_info("    mov_from_dr[%i]: %u", i, estimate(stats.mov_from_dr[i]));
             }
           }
 
@@ -430,7 +701,7 @@ void vmexit_stats_handler::storage_dump(const vmexit_stats_storage_t& storage_to
           {
             if (stats.mov_to_dr[i] > 0)
             {
-              hvpp_info("    mov_to_dr[%i]: %u", i, stats.mov_to_dr[i]);
+              hvpp_info("    mov_to_dr[%i]: %u", i, estimate(stats.mov_to_dr[i]));
             }
           }
           break;
@@ -440,7 +711,7 @@ void vmexit_stats_handler::storage_dump(const vmexit_stats_storage_t& storage_to
           {
             if (stats.gdtr_idtr[i] > 0)
             {
-              hvpp_info("    %s: %u", vmx::instruction_info_gdtr_idtr_to_string(i), stats.gdtr_idtr[i]);
+              hvpp_info("    %s: %u", vmx::instruction_info_gdtr_idtr_to_string(i), estimate(stats.gdtr_idtr[i]));
             }
           }
           break;
@@ -450,72 +721,50 @@ void vmexit_stats_handler::storage_dump(const vmexit_stats_storage_t& storage_to
           {
             if (stats.ldtr_tr[i] > 0)
             {
-              hvpp_info("    %s: %u", vmx::instruction_info_ldtr_tr_to_string(i), stats.ldtr_tr[i]);
+              hvpp_info("    %s: %u", vmx::instruction_info_ldtr_tr_to_string(i), estimate(stats.ldtr_tr[i]));
             }
           }
           break;
 
         case vmx::exit_reason::execute_io_instruction:
-          for (uint32_t i = 0; i < std::size(stats.io_in); ++i)
+          detail::sparse_counter_sorted_for_each(stats.io_in, [&](uint32_t port, uint32_t count) {
+            hvpp_info("    in (0x%04x): %u", port, estimate(count));
+          });
+
+          if (stats.io_in.overflow() > 0)
           {
-            if (stats.io_in[i] > 0)
-            {
-              hvpp_info("    in (0x%04x): %u", i, stats.io_in[i]);
-            }
+            hvpp_info("    in (OTHER): %u", estimate(stats.io_in.overflow()));
           }
 
-          for (uint32_t i = 0; i < std::size(stats.io_out); ++i)
+          detail::sparse_counter_sorted_for_each(stats.io_out, [&](uint32_t port, uint32_t count) {
+            hvpp_info("    out (0x%04x): %u", port, estimate(count));
+          });
+
+          if (stats.io_out.overflow() > 0)
           {
-            if (stats.io_out[i] > 0)
-            {
-              hvpp_info("    out (0x%04x): %u", i, stats.io_out[i]);
-            }
+            hvpp_info("    out (OTHER): %u", estimate(stats.io_out.overflow()));
           }
           break;
 
         case vmx::exit_reason::execute_rdmsr:
-          for (uint32_t i = 0; i < std::size(stats.rdmsr_0); ++i)
-          {
-            if (stats.rdmsr_0[i])
-            {
-              hvpp_info("    0x%08x: %u", i, stats.rdmsr_0[i]);
-            }
-          }
+          detail::sparse_counter_sorted_for_each(stats.rdmsr, [&](uint32_t msr, uint32_t count) {
+            hvpp_info("    0x%08x: %u", msr, estimate(count));
+          });
 
-          for (uint32_t i = 0; i < std::size(stats.rdmsr_c); ++i)
+          if (stats.rdmsr.overflow() > 0)
           {
-            if (stats.rdmsr_c[i])
-            {
-              hvpp_info("    0x%08x: %u", i + 0xc000'0000u, stats.rdmsr_c[i]);
-            }
-          }
-
-          if (stats.rdmsr_other > 0)
-          {
-            hvpp_info("    (OTHER): %u", stats.rdmsr_other);
+            hvpp_info("    (OTHER): %u", estimate(stats.rdmsr.overflow()));
           }
           break;
 
         case vmx::exit_reason::execute_wrmsr:
-          for (uint32_t i = 0; i < std::size(stats.wrmsr_0); ++i)
-          {
-            if (stats.wrmsr_0[i])
-            {
-              hvpp_info("    0x%08x: %u", i, stats.wrmsr_0[i]);
-            }
-          }
-
-          for (uint32_t i = 0; i < std::size(stats.wrmsr_c); ++i)
-          {
-            if (stats.wrmsr_c[i])
-            {
-              hvpp_info("    0x%08x: %u", i + 0xc000'0000u, stats.wrmsr_c[i]);
-            }
-          }
+          detail::sparse_counter_sorted_for_each(stats.wrmsr, [&](uint32_t msr, uint32_t count) {
+            hvpp_info("    0x%08x: %u", msr, estimate(count));
+          });
 
-          if (stats.wrmsr_other > 0)
+          if (stats.wrmsr.overflow() > 0)
           {
-            hvpp_info("    (OTHER): %u", stats.wrmsr_other);
+            hvpp_info("    (OTHER): %u", estimate(stats.wrmsr.overflow()));
           }
           break;
       }
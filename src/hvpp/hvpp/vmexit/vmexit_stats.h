@@ -2,17 +2,286 @@
 #include "hvpp/vmexit.h"
 
 #include "hvpp/lib/bitmap.h"
+#include "hvpp/lib/percpu.h"
+#include "hvpp/lib/spinlock_stats.h"
 
+#include <array>
 #include <atomic>
+#include <type_traits>
 
 namespace hvpp {
 
+//
+// Fixed-capacity hash table of counters (open addressing, linear
+// probing).
+//
+// Used for sparse key spaces (I/O ports, MSRs), where only handful
+// of keys is ever hit, but dense array would have to cover whole
+// range of possible keys.  Slot is considered empty if its value is
+// zero - therefore zero-valued additions are ignored.
+//
+// If the key can't be placed within max_probe slots, the value is
+// accounted in the overflow() counter instead.
+//
+
+template <
+  typename T,
+  size_t CAPACITY
+>
+class vmexit_sparse_counter_t
+{
+  public:
+    static constexpr size_t capacity  = CAPACITY;
+    static constexpr size_t max_probe = 16;
+
+    static_assert(capacity >= max_probe && (capacity & (capacity - 1)) == 0,
+                  "Capacity must be power of 2");
+
+    struct entry_t
+    {
+      uint32_t key;
+      T        value;
+    };
+
+    void add(uint32_t key, T value = 1) noexcept
+    {
+      if (!value)
+      {
+        return;
+      }
+
+      auto index = hash(key);
+
+      for (size_t probe = 0; probe < max_probe; ++probe)
+      {
+        auto& entry = entries_[index];
+
+        if (!entry.value)
+        {
+          entry.key   = key;
+          entry.value = value;
+          return;
+        }
+
+        if (entry.key == key)
+        {
+          entry.value += value;
+          return;
+        }
+
+        index = (index + 1) & (capacity - 1);
+      }
+
+      overflow_ += value;
+    }
+
+    T get(uint32_t key) const noexcept
+    {
+      auto index = hash(key);
+
+      for (size_t probe = 0; probe < max_probe; ++probe)
+      {
+        const auto& entry = entries_[index];
+
+        if (!entry.value)
+        {
+          break;
+        }
+
+        if (entry.key == key)
+        {
+          return entry.value;
+        }
+
+        index = (index + 1) & (capacity - 1);
+      }
+
+      return T{};
+    }
+
+    T overflow() const noexcept
+    { return overflow_; }
+
+    //
+    // Sum of all values (including the overflow() counter).
+    //
+    T total() const noexcept
+    {
+      T result = overflow_;
+      for_each([&result](uint32_t, T value) { result += value; });
+      return result;
+    }
+
+    template <typename FN>
+    void for_each(FN fn) const noexcept
+    {
+      for (const auto& entry : entries_)
+      {
+        if (entry.value)
+        {
+          fn(entry.key, entry.value);
+        }
+      }
+    }
+
+    void merge(const vmexit_sparse_counter_t& other) noexcept
+    {
+      other.for_each([this](uint32_t key, T value) {
+        add(key, value);
+      });
+
+      overflow_ += other.overflow_;
+    }
+
+    //
+    // Add difference "lhs - rhs" into this table ("rhs" is expected
+    // to be older copy of "lhs").
+    //
+    // Tables merged from several VCPUs (see merge()) don't have to
+    // place the same key the same way - key which is in the table
+    // in "lhs" might have been counted in the overflow() counter
+    // in "rhs" (and vice versa).  Therefore difference of each key
+    // is clamped at 0 and the overflow() counter receives the rest
+    // of the difference of total() values (clamped at 0 as well).
+    //
+    void merge_delta(const vmexit_sparse_counter_t& lhs, const vmexit_sparse_counter_t& rhs) noexcept
+    {
+      const auto lhs_total = lhs.total();
+      const auto rhs_total = rhs.total();
+            auto remaining = lhs_total > rhs_total ? lhs_total - rhs_total : T{};
+
+      lhs.for_each([this, &rhs, &remaining](uint32_t key, T value) {
+        const auto previous = rhs.get(key);
+        const auto delta    = value > previous ? value - previous : T{};
+        const auto clamped  = delta < remaining ? delta : remaining;
+
+        add(key, clamped);
+        remaining -= clamped;
+      });
+
+      overflow_ += remaining;
+    }
+
+  private:
+    static constexpr size_t capacity_bits() noexcept
+    {
+      size_t result = 0;
+      while ((size_t(1) << result) < capacity) { ++result; }
+      return result;
+    }
+
+    static size_t hash(uint32_t key) noexcept
+    {
+      //
+      // Fibonacci hashing - take the top bits of the product.
+      //
+      return static_cast<uint32_t>(key * 0x9e37'79b1u) >> (32 - capacity_bits());
+    }
+
+    std::array<entry_t, capacity> entries_;
+    T                             overflow_;
+};
+
 //
 // Structure for storing statistics about VM-exits.
-// Each member of the vmexit_storage_t structure
-// is treated as VM-exit counter.
+// Each member of this structure is treated as VM-exit counter.
+//
+// Unlike vmexit_storage_t, I/O ports and MSRs aren't stored in dense
+// arrays (which would take ~640kb per CPU), but in small hash tables.
+// Counters that are hit on (almost) every VM-exit are kept together
+// at the beginning of the structure (the per-VCPU copy is aligned
+// to the cache line by vmexit_stats_handler).
+//
+// Note that this structure is trivially copyable - it is safe to
+// memset() or memcpy() it.
+//
+
+struct vmexit_stats_storage_t
+{
+  static constexpr size_t cpuid_0_max  = 16;
+  static constexpr size_t cpuid_8_max  = 16;
+  static constexpr size_t io_max       = 256;
+  static constexpr size_t msr_max      = 256;
+
+  //
+  // Hot counters, see vmexit_storage_t for their description.
+  //
+  std::array<uint32_t, 65>            vmexit;
+
+  //
+  // Count of VM-exits for which detailed statistics (all members
+  // below) were collected.  Equals to vmexit[] unless sampling
+  // is enabled (see vmexit_stats_handler::sample_rate()).
+  //
+  std::array<uint32_t, 65>            vmexit_sampled;
+
+  //
+  // Vectors of exception_or_nmi and external_interrupt VM-exits,
+  // respectively.  They're kept apart, because each VM-exit reason
+  // has its own sample rate (and therefore its own scaling).
+  //
+  std::array<uint32_t, 256>           exception_vector;
+  std::array<uint32_t, 256>           interrupt_vector;
+
+  std::array<uint32_t, cpuid_0_max>   cpuid_0;
+  std::array<uint32_t, cpuid_8_max>   cpuid_8;
+  uint32_t                            cpuid_other;
+
+  std::array<uint32_t, 8>             mov_from_cr;
+  std::array<uint32_t, 8>             mov_to_cr;
+  uint32_t                            clts;
+  uint32_t                            lmsw;
+
+  std::array<uint32_t, 8>             mov_from_dr;
+  std::array<uint32_t, 8>             mov_to_dr;
+
+  std::array<uint32_t, 4>             gdtr_idtr;
+  std::array<uint32_t, 4>             ldtr_tr;
+
+  //
+  // Sparse counters.
+  // Keys are I/O port numbers and MSR numbers, respectively.
+  // MSRs that didn't fit into the table are counted in the
+  // overflow() counter.
+  //
+  vmexit_sparse_counter_t<uint32_t, io_max>  io_in;
+  vmexit_sparse_counter_t<uint32_t, io_max>  io_out;
+
+  vmexit_sparse_counter_t<uint32_t, msr_max> rdmsr;
+  vmexit_sparse_counter_t<uint32_t, msr_max> wrmsr;
+};
+
+static_assert(std::is_trivially_copyable_v<vmexit_stats_storage_t>);
+
+//
+// Result of vmexit_stats_handler::snapshot().
+//
+// "total" holds statistics merged from all VCPUs, "delta" holds
+// difference between "total" and "total" of the previous snapshot
+// (i.e. VM-exits counted since the previous snapshot has been taken).
 //
-using vmexit_stats_storage_t = vmexit_storage_t<uint32_t>;
+// Note that delta of the sparse counters is exact only as long as
+// they don't overflow.
+//
+// VCPUs aren't stopped while they're being read.  Statistics of VCPU
+// which kept updating them during each of the read attempts are copied
+// anyway (they might be torn - i.e. partially updated) and such VCPUs
+// are counted in "torn_cpu_count".
+//
+
+struct vmexit_stats_snapshot_t
+{
+  uint64_t               snapshot_id;
+  uint64_t               timestamp;           // TSC
+  uint64_t               timestamp_previous;  // TSC (0 if no previous snapshot)
+  uint32_t               torn_cpu_count;
+  uint32_t               reserved;
+
+  vmexit_stats_storage_t total;
+  vmexit_stats_storage_t delta;
+};
+
+static_assert(std::is_trivially_copyable_v<vmexit_stats_snapshot_t>);
 
 //
 // Simple VM-exit handler which performs statistics about VM-exits
@@ -26,17 +295,76 @@ class vmexit_stats_handler
     vmexit_stats_handler() noexcept;
     ~vmexit_stats_handler() noexcept override;
 
+    auto setup(vcpu_t& vp) noexcept -> error_code_t override;
     void handle(vcpu_t& vp) noexcept override;
 
     bitmap<>& trace_bitmap() noexcept
     { return vmexit_trace_bitmap_; }
 
-    vmexit_stats_storage_t* storage() const noexcept
-    { return storage_ ; }
+    //
+    // Collect detailed statistics (and trace) only 1 in "rate"
+    // VM-exits of given reason.  Each VCPU counts VM-exits on its
+    // own.  Values printed by dump() are scaled accordingly.
+    //
+    // Rate 1 (default) means every VM-exit is sampled.
+    //
+    void sample_rate(vmx::exit_reason exit_reason, uint32_t rate) noexcept;
+    uint32_t sample_rate(vmx::exit_reason exit_reason) const noexcept;
+
+    //
+    // Must not be called before setup().
+    //
+    const vmexit_stats_storage_t& storage(uint32_t cpu_index) const noexcept
+    { hvpp_assert(storage_.is_initialized()); return storage_.get(cpu_index).storage; }
 
     void dump() noexcept;
 
+    //
+    // Take consistent snapshot of statistics of all VCPUs without
+    // stopping them.  Intended to be called from VMX non-root mode
+    // (e.g. from IOCTL handler).
+    //
+    void snapshot(vmexit_stats_snapshot_t& result) noexcept;
+
   private:
+    //
+    // Per-VCPU statistics protected by the sequence lock.
+    //
+    // The "sequence" is odd while the VCPU updates its statistics.
+    // Readers copy the storage and retry (at most storage_read_retry_max
+    // times) if the sequence was odd or has changed during the copy.
+    // Writer (VCPU) never waits.
+    //
+    // The "sample_countdown" is private to the VCPU and it isn't
+    // part of the statistics.
+    //
+    struct alignas(64) storage_per_cpu_t
+    {
+      std::atomic<uint32_t>     sequence;
+      std::array<uint32_t, 65>  sample_countdown;
+      vmexit_stats_storage_t    storage;
+    };
+
+    //
+    // Collect detailed statistics of the sampled VM-exit.
+    //
+    void handle_sampled(vcpu_t& vp, vmexit_stats_storage_t& stats) noexcept;
+
+    //
+    // Copy statistics of the specified VCPU into "result".
+    // Returns false if consistent copy couldn't be made within
+    // storage_read_retry_max attempts - "result" then holds the last
+    // (possibly torn) copy.
+    //
+    static constexpr uint32_t storage_read_retry_max = 1000;
+
+    bool storage_read(uint32_t cpu_index, vmexit_stats_storage_t& result) const noexcept;
+
+    //
+    // Compute "result = lhs - rhs".
+    //
+    void storage_delta(vmexit_stats_storage_t& result, const vmexit_stats_storage_t& lhs, const vmexit_stats_storage_t& rhs) const noexcept;
+
     //
     // Update "lhs" stats by adding to them values of "rhs" stats.
     //
@@ -48,9 +376,9 @@ class vmexit_stats_handler
     void storage_dump(const vmexit_stats_storage_t& storage_to_dump) const noexcept;
 
     //
-    // Array of statistics (per VCPU).
+    // Statistics of each VCPU (in its per-CPU block).
     //
-    vmexit_stats_storage_t* storage_;
+    percpu::slot_t<storage_per_cpu_t> storage_;
 
     //
     // Merged statistics.
@@ -58,12 +386,33 @@ class vmexit_stats_handler
     //
     vmexit_stats_storage_t storage_merged_;
 
+    //
+    // Scratch copy of single VCPU statistics and merged statistics
+    // of the previous snapshot.
+    // Used in dump() and snapshot() methods.
+    //
+    vmexit_stats_storage_t storage_scratch_;
+    vmexit_stats_storage_t storage_previous_;
+
+    uint64_t snapshot_id_;
+    uint64_t snapshot_timestamp_;
+
+    //
+    // Serializes dump() and snapshot() callers.
+    //
+    instrumented_lock<spinlock> snapshot_lock_;
+
     //
     // Bitmap of traced VM-exit reasons.
     // There are currently defined 65 VM-exit reasons.
     //
     bitmap<65> vmexit_trace_bitmap_;
 
+    //
+    // Sample rate of each VM-exit reason.
+    //
+    std::array<uint32_t, 65> sample_rate_;
+
     //
     // Count of terminated VCPUs.
     //
@@ -0,0 +1,491 @@
+//
+// windows.h would otherwise define min() and max() macros, which
+// break std::min()/std::max() (used also by hvpp/lib/spinlock.h).
+//
+#define NOMINMAX
+
+#include "benchmark.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <intrin.h>
+
+#include "../../hvpp/hvpp/lib/spinlock.h"
+
+//
+// Parameters of the benchmarks.  They're fixed, so that the results
+// are comparable between runs (and between machines).
+//
+static constexpr DWORD BenchmarkDurationMs     = 500;
+static constexpr ULONG CriticalSectionLength[] = { 0, 100, 1000 };
+static constexpr ULONG ReadCriticalSectionLength = 100;
+static constexpr ULONG WriteInterval[]          = { 10, 100, 1000 };
+static constexpr ULONG PerCpuUpdateCount        = 16;
+
+//
+// Same as percpu::block_size (hvpp/lib/percpu.h isn't included, because
+// it pulls in kernel-only hvpp/lib/mp.h).
+//
+static constexpr SIZE_T PerCpuBlockSize = 4 * 4096;
+
+//
+// Histogram of latencies (in TSC cycles).  Values below 16 are counted
+// exactly, larger values are split into 16 sub-buckets per power of 2
+// (i.e. they're rounded down with precision better than 1/16).
+//
+struct LATENCY_HISTOGRAM
+{
+  static constexpr ULONG SubBucketBits  = 4;
+  static constexpr ULONG SubBucketCount = 1 << SubBucketBits;
+  static constexpr ULONG BucketCount    = 64 * SubBucketCount;
+
+  ULONGLONG Count[BucketCount];
+  ULONGLONG Total;
+  ULONGLONG Maximum;
+
+  static ULONG Index(ULONGLONG Value)
+  {
+    if (Value < SubBucketCount)
+    {
+      return (ULONG)Value;
+    }
+
+    ULONG MostSignificantBit;
+    _BitScanReverse64(&MostSignificantBit, Value);
+
+    const auto Shift = MostSignificantBit - SubBucketBits;
+    return ((Shift + 1) << SubBucketBits) + (ULONG)((Value >> Shift) & (SubBucketCount - 1));
+  }
+
+  static ULONGLONG LowerBound(ULONG Index)
+  {
+    if (Index < SubBucketCount)
+    {
+      return Index;
+    }
+
+    const auto Shift = (Index >> SubBucketBits) - 1;
+    return (ULONGLONG)(SubBucketCount + (Index & (SubBucketCount - 1))) << Shift;
+  }
+
+  void Add(ULONGLONG Value)
+  {
+    Count[Index(Value)] += 1;
+    Total += 1;
+    Maximum = std::max(Maximum, Value);
+  }
+
+  void Merge(const LATENCY_HISTOGRAM& Other)
+  {
+    for (ULONG Index = 0; Index < BucketCount; ++Index)
+    {
+      Count[Index] += Other.Count[Index];
+    }
+
+    Total  += Other.Total;
+    Maximum = std::max(Maximum, Other.Maximum);
+  }
+
+  ULONGLONG Percentile(double Fraction) const
+  {
+    const auto Target = (ULONGLONG)(Fraction * Total);
+    ULONGLONG Cumulative = 0;
+
+    for (ULONG Index = 0; Index < BucketCount; ++Index)
+    {
+      Cumulative += Count[Index];
+
+      if (Cumulative > Target)
+      {
+        return LowerBound(Index);
+      }
+    }
+
+    return Maximum;
+  }
+};
+
+struct alignas(64) THREAD_STATE
+{
+  ULONGLONG         OperationCount;
+  LATENCY_HISTOGRAM Latency;
+};
+
+static
+BOOL
+SetCurrentThreadProcessor(
+  ULONG ProcessorIndex
+  )
+{
+  //
+  // Pin the current thread to the logical processor with given
+  // system-wide index (across processor groups).
+  //
+  WORD GroupCount = GetActiveProcessorGroupCount();
+  for (WORD GroupNumber = 0; GroupNumber < GroupCount; ++GroupNumber)
+  {
+    DWORD ProcessorCount = GetActiveProcessorCount(GroupNumber);
+
+    if (ProcessorIndex < ProcessorCount)
+    {
+      GROUP_AFFINITY GroupAffinity = { 0 };
+      GroupAffinity.Mask = (KAFFINITY)(1) << ProcessorIndex;
+      GroupAffinity.Group = GroupNumber;
+      return SetThreadGroupAffinity(GetCurrentThread(), &GroupAffinity, NULL);
+    }
+
+    ProcessorIndex -= ProcessorCount;
+  }
+
+  return FALSE;
+}
+
+static
+VOID
+CriticalSection(
+  volatile ULONGLONG* SharedData,
+  ULONG Length
+  )
+{
+  //
+  // Touch the shared cache line - the same way real critical sections
+  // touch the data protected by the lock.
+  //
+  for (ULONG Index = 0; Index < Length; ++Index)
+  {
+    *SharedData = *SharedData + 1;
+  }
+}
+
+static
+VOID
+ReadCriticalSection(
+  volatile ULONGLONG* SharedData,
+  ULONG Length
+  )
+{
+  //
+  // Read-only counterpart of CriticalSection() - readers keep the cache
+  // line in shared state.
+  //
+  ULONGLONG Sum = 0;
+  for (ULONG Index = 0; Index < Length; ++Index)
+  {
+    Sum += *SharedData;
+  }
+
+  (void)Sum;
+}
+
+//
+// Run "Operation" on "ThreadCount" threads for BenchmarkDurationMs and
+// print one row of results.  "Operation" performs one locked operation
+// and returns number of cycles it waited for the lock.
+//
+template <typename TOperation>
+static
+VOID
+RunBenchmark(
+  const CHAR* LockName,
+  const CHAR* WorkloadName,
+  ULONG ThreadCount,
+  TOperation&& Operation,
+  FILE* Output
+  )
+{
+  std::vector<THREAD_STATE> ThreadState(ThreadCount);
+  std::vector<std::thread> ThreadList;
+
+  std::atomic<ULONG> ReadyCount{ 0 };
+  std::atomic<bool>  Start{ false };
+  std::atomic<bool>  Stop{ false };
+
+  for (ULONG ThreadIndex = 0; ThreadIndex < ThreadCount; ++ThreadIndex)
+  {
+    ThreadList.emplace_back([&, ThreadIndex]() {
+      auto& State = ThreadState[ThreadIndex];
+
+      SetCurrentThreadProcessor(ThreadIndex);
+
+      //
+      // Wait until all threads are pinned, so that they all start
+      // at the same time.
+      //
+      ReadyCount.fetch_add(1);
+      while (!Start.load(std::memory_order_acquire))
+      {
+        _mm_pause();
+      }
+
+      ULONGLONG Iteration = 0;
+      while (!Stop.load(std::memory_order_relaxed))
+      {
+        State.Latency.Add(Operation(ThreadIndex, Iteration++));
+      }
+
+      State.OperationCount = Iteration;
+    });
+  }
+
+  while (ReadyCount.load() != ThreadCount)
+  {
+    Sleep(1);
+  }
+
+  LARGE_INTEGER Frequency;
+  LARGE_INTEGER StartTime;
+  LARGE_INTEGER StopTime;
+  QueryPerformanceFrequency(&Frequency);
+  QueryPerformanceCounter(&StartTime);
+
+  Start.store(true, std::memory_order_release);
+  Sleep(BenchmarkDurationMs);
+  Stop.store(true, std::memory_order_relaxed);
+
+  for (auto& Thread : ThreadList)
+  {
+    Thread.join();
+  }
+
+  QueryPerformanceCounter(&StopTime);
+
+  //
+  // Merge results of all threads.
+  //
+  LATENCY_HISTOGRAM Latency{};
+  ULONGLONG OperationCount = 0;
+  ULONGLONG MinimumCount = ~0ull;
+  ULONGLONG MaximumCount = 0;
+
+  for (const auto& State : ThreadState)
+  {
+    Latency.Merge(State.Latency);
+
+    OperationCount += State.OperationCount;
+    MinimumCount    = std::min(MinimumCount, State.OperationCount);
+    MaximumCount    = std::max(MaximumCount, State.OperationCount);
+  }
+
+  const auto Seconds = (double)(StopTime.QuadPart - StartTime.QuadPart) / Frequency.QuadPart;
+
+  fprintf(Output, "%-16s %-12s %7u %10.2f %8llu %8llu %8llu %12llu %9.2f\n",
+          LockName,
+          WorkloadName,
+          ThreadCount,
+          OperationCount / Seconds / 1e6,
+          Latency.Percentile(0.50),
+          Latency.Percentile(0.99),
+          Latency.Percentile(0.999),
+          Latency.Maximum,
+          MaximumCount ? (double)MinimumCount / MaximumCount : 0.0);
+}
+
+static
+VOID
+PrintHeader(
+  const CHAR* Name,
+  FILE* Output
+  )
+{
+  fprintf(Output, "%-16s %-12s %7s %10s %8s %8s %8s %12s %9s\n",
+          Name, "Workload", "Threads", "Mops/s", "p50", "p99", "p99.9", "max", "fairness");
+}
+
+template <typename TFunction>
+static
+VOID
+ForEachThreadCount(
+  TFunction&& Function
+  )
+{
+  //
+  // 1, 2, 4, ... and the number of active processors.
+  //
+  const auto ProcessorCount = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+
+  for (ULONG ThreadCount = 1; ThreadCount < ProcessorCount; ThreadCount *= 2)
+  {
+    Function(ThreadCount);
+  }
+
+  Function((ULONG)ProcessorCount);
+}
+
+template <typename TLock>
+static
+VOID
+BenchmarkExclusiveLock(
+  const CHAR* LockName,
+  FILE* Output
+  )
+{
+  ForEachThreadCount([&](ULONG ThreadCount) {
+    for (const auto Length : CriticalSectionLength)
+    {
+      TLock Lock;
+      alignas(64) volatile ULONGLONG SharedData = 0;
+
+      CHAR WorkloadName[32];
+      sprintf_s(WorkloadName, "cs=%u", Length);
+
+      RunBenchmark(LockName, WorkloadName, ThreadCount, [&](ULONG, ULONGLONG) {
+        const auto StartTsc = __rdtsc();
+        Lock.lock();
+        const auto Wait = __rdtsc() - StartTsc;
+
+        CriticalSection(&SharedData, Length);
+
+        Lock.unlock();
+        return Wait;
+      }, Output);
+    }
+  });
+}
+
+template <typename TLock>
+static
+VOID
+BenchmarkReadMostlyLock(
+  const CHAR* LockName,
+  FILE* Output
+  )
+{
+  //
+  // Locks without shared mode (TLock::lock_shared()) take readers
+  // exclusively - that's what rw_spinlock is compared against.
+  //
+  constexpr bool HasSharedMode = requires(TLock& Lock) { Lock.lock_shared(); };
+
+  ForEachThreadCount([&](ULONG ThreadCount) {
+    for (const auto Interval : WriteInterval)
+    {
+      TLock Lock;
+      alignas(64) volatile ULONGLONG SharedData = 0;
+
+      CHAR WorkloadName[32];
+      sprintf_s(WorkloadName, "r=%.1f%%", 100.0 - 100.0 / Interval);
+
+      RunBenchmark(LockName, WorkloadName, ThreadCount, [&](ULONG, ULONGLONG Iteration) {
+        //
+        // Every Interval-th operation of each thread is a write.
+        //
+        const bool Write = (Iteration % Interval) == Interval - 1;
+
+        const auto StartTsc = __rdtsc();
+        if constexpr (HasSharedMode)
+        {
+          Write ? Lock.lock() : Lock.lock_shared();
+        }
+        else
+        {
+          Lock.lock();
+        }
+        const auto Wait = __rdtsc() - StartTsc;
+
+        Write
+          ? CriticalSection(&SharedData, ReadCriticalSectionLength)
+          : ReadCriticalSection(&SharedData, ReadCriticalSectionLength);
+
+        if constexpr (HasSharedMode)
+        {
+          Write ? Lock.unlock() : Lock.unlock_shared();
+        }
+        else
+        {
+          Lock.unlock();
+        }
+        return Wait;
+      }, Output);
+    }
+  });
+}
+
+static
+VOID
+BenchmarkPerCpuLayout(
+  const CHAR* LayoutName,
+  SIZE_T Stride,
+  FILE* Output
+  )
+{
+  ForEachThreadCount([&](ULONG ThreadCount) {
+    //
+    // Each thread updates only its own counter - any slowdown with
+    // growing number of threads is caused by the cache line being
+    // shared with the counters of other threads (false sharing).
+    //
+    const auto Size = Stride * ThreadCount;
+    const auto Base = (PUCHAR)VirtualAlloc(NULL, Size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+
+    if (!Base)
+    {
+      fprintf(Output, "%-16s cannot allocate %Iu bytes\n", LayoutName, Size);
+      return;
+    }
+
+    CHAR WorkloadName[32];
+    sprintf_s(WorkloadName, "inc=%u", PerCpuUpdateCount);
+
+    RunBenchmark(LayoutName, WorkloadName, ThreadCount, [&](ULONG ThreadIndex, ULONGLONG) {
+      const auto Counter = (volatile ULONGLONG*)(Base + ThreadIndex * Stride);
+
+      const auto StartTsc = __rdtsc();
+      for (ULONG Index = 0; Index < PerCpuUpdateCount; ++Index)
+      {
+        *Counter = *Counter + 1;
+      }
+      return __rdtsc() - StartTsc;
+    }, Output);
+
+    VirtualFree(Base, 0, MEM_RELEASE);
+  });
+}
+
+VOID
+BenchmarkSpinlock(
+  FILE* Output
+  )
+{
+  //
+  // "cs=N" means N increments of the shared data while the lock
+  // is held.
+  //
+  PrintHeader("Lock", Output);
+
+  BenchmarkExclusiveLock<spinlock>("spinlock", Output);
+  BenchmarkExclusiveLock<ticket_spinlock>("ticket_spinlock", Output);
+  BenchmarkExclusiveLock<mcs_spinlock>("mcs_spinlock", Output);
+}
+
+VOID
+BenchmarkRwSpinlock(
+  FILE* Output
+  )
+{
+  //
+  // "r=X%" means X% of operations of each thread are reads.
+  //
+  PrintHeader("Lock", Output);
+
+  BenchmarkReadMostlyLock<spinlock>("spinlock", Output);
+  BenchmarkReadMostlyLock<rw_spinlock>("rw_spinlock", Output);
+}
+
+VOID
+BenchmarkPerCpu(
+  FILE* Output
+  )
+{
+  //
+  // "inc=N" means N increments of the counter of the current thread.
+  // Latency columns show cycles of one operation (i.e. of N increments),
+  // not lock acquisition.
+  //
+  PrintHeader("Layout", Output);
+
+  BenchmarkPerCpuLayout("packed", sizeof(ULONGLONG), Output);
+  BenchmarkPerCpuLayout("percpu", PerCpuBlockSize, Output);
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdio>
+
+#include <windows.h>
+
+//
+// User-mode benchmarks of the synchronization primitives used by hvpp
+// (hvpp/lib/spinlock.h).  The locks are header-only and don't depend
+// on the kernel, therefore they can be measured here - without loading
+// the driver.
+//
+// Each benchmark runs for a fixed duration with worker threads pinned
+// to logical processors 0..N-1 (N = 1, 2, 4, ... up to the number of
+// active processors).  For each configuration it prints:
+//   - throughput (millions of operations per second, all threads),
+//   - acquire latency percentiles and maximum (in TSC cycles),
+//   - fairness (operations of the slowest thread / operations of the
+//     fastest thread - 1.00 means perfectly fair).
+//
+// Run "hvppctrl.exe benchmark".
+//
+
+//
+// Exclusive locks (spinlock, ticket_spinlock, mcs_spinlock) across
+// thread counts and critical-section lengths.
+//
+VOID
+BenchmarkSpinlock(
+  FILE* Output
+  );
+
+//
+// Read-mostly workloads (90%, 99% and 99.9% reads), rw_spinlock
+// (readers take the lock shared) against spinlock (readers take
+// the lock exclusively).
+//
+VOID
+BenchmarkRwSpinlock(
+  FILE* Output
+  );
+
+//
+// Per-CPU counters updated by their own thread only, laid out as
+// "packed" (adjacent 8-byte counters - the former per-CPU arrays, such
+// as mm's allocator[HVPP_MAX_CPU]) and as "percpu" (one counter per
+// page-aligned block of percpu::block_size bytes - hvpp/lib/percpu.h).
+//
+VOID
+BenchmarkPerCpu(
+  FILE* Output
+  );
@@ -0,0 +1,215 @@
+#include "trace_decoder.h"
+
+#include <cstdarg>
+#include <cstring>
+
+#include "../../hvpp/hvpp/lib/log_format.h"
+
+using namespace logger::format;
+
+struct IMAGE_CONTEXT
+{
+  PUCHAR    Image;          // Image mapped at section alignment.
+  SIZE_T    ImageSize;
+  ULONGLONG PreferredBase;  // ImageBase from the optional header.
+  PUCHAR    Section;        // ".hvppfmt" section.
+  SIZE_T    SectionSize;
+};
+
+static
+const CHAR*
+ResolveString(
+  const IMAGE_CONTEXT& Context,
+  ULONGLONG Base,
+  ULONGLONG Address
+  )
+{
+  //
+  // Translate the address (relative to "Base") into the mapped image
+  // and make sure the string is terminated within the image.
+  //
+  if (Address < Base || Address - Base >= Context.ImageSize)
+  {
+    return nullptr;
+  }
+
+  const auto Rva = (SIZE_T)(Address - Base);
+  const auto String = (const CHAR*)(Context.Image + Rva);
+
+  if (strnlen(String, Context.ImageSize - Rva) == Context.ImageSize - Rva)
+  {
+    return nullptr;
+  }
+
+  return String;
+}
+
+static
+BOOL
+OpenImage(
+  HMODULE Module,
+  IMAGE_CONTEXT& Context
+  )
+{
+  //
+  // Low bits of the module handle are set when the image is loaded
+  // as a resource.
+  //
+  const auto Image = (PUCHAR)((ULONG_PTR)Module & ~(ULONG_PTR)3);
+
+  const auto DosHeader = (PIMAGE_DOS_HEADER)Image;
+  if (DosHeader->e_magic != IMAGE_DOS_SIGNATURE)
+  {
+    return FALSE;
+  }
+
+  const auto NtHeaders = (PIMAGE_NT_HEADERS64)(Image + DosHeader->e_lfanew);
+  if (NtHeaders->Signature != IMAGE_NT_SIGNATURE ||
+      NtHeaders->OptionalHeader.Magic != IMAGE_NT_OPTIONAL_HDR64_MAGIC)
+  {
+    return FALSE;
+  }
+
+  Context.Image         = Image;
+  Context.ImageSize     = NtHeaders->OptionalHeader.SizeOfImage;
+  Context.PreferredBase = NtHeaders->OptionalHeader.ImageBase;
+
+  auto SectionHeader = IMAGE_FIRST_SECTION(NtHeaders);
+  for (WORD Index = 0; Index < NtHeaders->FileHeader.NumberOfSections; ++Index, ++SectionHeader)
+  {
+    if (!strncmp((const CHAR*)SectionHeader->Name, HVPP_FORMAT_SECTION_NAME, IMAGE_SIZEOF_SHORT_NAME))
+    {
+      Context.Section     = Image + SectionHeader->VirtualAddress;
+      Context.SectionSize = SectionHeader->Misc.VirtualSize;
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+static
+void
+DecodeRecord(
+  const IMAGE_CONTEXT& Context,
+  const raw_header_t& Header,
+  const raw_record_t& Record,
+  const UINT64* RecordArgs,
+  FILE* Output
+  )
+{
+  const auto Entry = (const entry_t*)Context.Section + Record.format_id;
+
+  if (Record.format_id == 0 ||
+      (PUCHAR)(Entry + 1) > Context.Section + Context.SectionSize ||
+      Entry->arg_count != Record.arg_count)
+  {
+    fprintf(Output, "#%u\t%llu\t<invalid format ID %u>\n",
+            Record.cpu_index, Record.tsc, Record.format_id);
+    return;
+  }
+
+  //
+  // Format string and function name are referenced by the preferred
+  // base (the image isn't relocated), "%s" arguments by the runtime
+  // base of the driver.
+  //
+  // Zero-filled entries (linker padding, see log_format.h) are rejected
+  // here as well - their strings don't resolve.
+  //
+  const auto Format   = ResolveString(Context, Context.PreferredBase, (ULONGLONG)Entry->format);
+  const auto Function = ResolveString(Context, Context.PreferredBase, (ULONGLONG)Entry->function);
+
+  if (!Format || !Function)
+  {
+    fprintf(Output, "#%u\t%llu\t<invalid format entry %u>\n",
+            Record.cpu_index, Record.tsc, Record.format_id);
+    return;
+  }
+
+  UINT64 Args[max_arg_count];
+  for (UINT32 Index = 0; Index < Record.arg_count; ++Index)
+  {
+    Args[Index] = RecordArgs[Index];
+
+    if (Entry->arg_type[Index] == arg_type_t::string)
+    {
+      const auto String = ResolveString(Context, Header.image_base, RecordArgs[Index]);
+      Args[Index] = (UINT64)(String ? String : "<?>");
+    }
+  }
+
+  //
+  // On x64, va_list is just a pointer to the array of 64-bit
+  // arguments.
+  //
+  CHAR Message[512];
+  vsnprintf(Message, sizeof(Message), Format, (va_list)Args);
+
+  fprintf(Output, "#%u\t%llu\t%s\t%s\n",
+          Record.cpu_index, Record.tsc, Function, Message);
+}
+
+BOOL
+TraceDecode(
+  const CHAR* DriverPath,
+  const VOID* Buffer,
+  SIZE_T BufferSize,
+  FILE* Output
+  )
+{
+  if (BufferSize < sizeof(raw_header_t))
+  {
+    return FALSE;
+  }
+
+  const auto& Header = *(const raw_header_t*)Buffer;
+  if (Header.size < sizeof(raw_header_t) || Header.size > BufferSize)
+  {
+    return FALSE;
+  }
+
+  //
+  // Map the driver image as an image (sections at their RVAs), but
+  // don't let the loader touch it otherwise.
+  //
+  HMODULE Module = LoadLibraryExA(DriverPath, NULL, LOAD_LIBRARY_AS_IMAGE_RESOURCE);
+  if (!Module)
+  {
+    return FALSE;
+  }
+
+  IMAGE_CONTEXT Context = { 0 };
+  BOOL Result = OpenImage(Module, Context);
+
+  if (Result)
+  {
+    auto Data = (const UCHAR*)Buffer + sizeof(raw_header_t);
+    auto DataEnd = (const UCHAR*)Buffer + Header.size;
+
+    for (UINT32 Index = 0; Index < Header.record_count; ++Index)
+    {
+      if (Data + sizeof(raw_record_t) > DataEnd)
+      {
+        Result = FALSE;
+        break;
+      }
+
+      const auto& Record = *(const raw_record_t*)Data;
+      const auto RecordArgs = (const UINT64*)(Data + sizeof(raw_record_t));
+      const auto RecordSize = sizeof(raw_record_t) + Record.arg_count * sizeof(UINT64);
+
+      if (Record.arg_count > max_arg_count || Data + RecordSize > DataEnd)
+      {
+        Result = FALSE;
+        break;
+      }
+
+      DecodeRecord(Context, Header, Record, RecordArgs, Output);
+      Data += RecordSize;
+    }
+  }
+
+  FreeLibrary(Module);
+  return Result;
+}
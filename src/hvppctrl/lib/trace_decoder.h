@@ -0,0 +1,20 @@
+#pragma once
+#include <cstdio>
+
+#include <windows.h>
+
+//
+// Decode raw records of the binary trace (as returned by the
+// ioctl_trace_read_raw_t IOCTL) and print them into "Output".
+//
+// Format strings, function names and static "%s" arguments are read
+// from the driver image file "DriverPath" - which must be the same
+// image that produced the records.
+//
+BOOL
+TraceDecode(
+  const CHAR* DriverPath,
+  const VOID* Buffer,
+  SIZE_T BufferSize,
+  FILE* Output
+  );
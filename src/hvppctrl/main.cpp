@@ -1,16 +1,30 @@
 #include <cstdio>
 #include <cstdint>
+#include <cstring>
 
 #include <windows.h>
 
 #include "ia32/asm.h"
+#include "lib/benchmark.h"
 #include "lib/mp.h"
+#include "lib/trace_decoder.h"
 #include "detours/detours.h"
 #include "udis86/udis86.h"
 
 #include "../hvpp/hvpp/lib/ioctl.h"
+#include "../hvpp/hvpp/lib/log_format.h"
+#include "../hvpp/hvpp/lib/shared_ring_layout.h"
+
+struct ioctl_shared_ring_map_data_t
+{
+  uint64_t address;
+  uint64_t size;
+};
 
 using ioctl_enable_io_debugbreak_t = ioctl_read_write_t<1, sizeof(uint16_t)>;
+using ioctl_shared_ring_map_t      = ioctl_read_write_t<3, sizeof(ioctl_shared_ring_map_data_t)>;
+using ioctl_shared_ring_unmap_t    = ioctl_none_t<4>;
+using ioctl_trace_read_raw_t       = ioctl_read_write_t<5, sizeof(logger::format::raw_header_t)>;
 
 #define PAGE_SIZE       4096
 #define PAGE_ALIGN(Va)  ((PVOID)((ULONG_PTR)(Va) & ~(PAGE_SIZE - 1)))
@@ -117,18 +131,34 @@ void TestHook()
     DetourTransactionCommit();
   };
 
-  auto Hide = [](void* PageRead, void* PageExecute)
+  //
+  // The hypervisor applies the (un)hook on all VCPUs itself - other
+  // VCPUs apply it on their next VM-exit.  Execute CPUID on each core
+  // to make sure it happens before we return.
+  //
+  auto Kick = []()
+  {
+    ForEachLogicalCore([](void*) { uint32_t CpuInfo[4]; ia32_asm_cpuid(CpuInfo, 0); }, nullptr);
+  };
+
+  auto Hide = [&](void* PageRead, void* PageExecute)
   {
-    struct CONTEXT { void* PageRead; void* PageExecute; } Context { PageRead, PageExecute };
-    ForEachLogicalCore([](void* ContextPtr) {
-      CONTEXT* Context = (CONTEXT*)ContextPtr;
-      ia32_asm_vmx_vmcall(0xc1, (uint64_t)Context->PageRead, (uint64_t)Context->PageExecute, 0);
-    }, &Context);
+    if (!ia32_asm_vmx_vmcall(0xc1, (uint64_t)PageRead, (uint64_t)PageExecute, 0))
+    {
+      printf("Warning: hook couldn't be posted to all cores\n");
+    }
+
+    Kick();
   };
 
-  auto Unhide = []()
+  auto Unhide = [&]()
   {
-    ForEachLogicalCore([](void*) { ia32_asm_vmx_vmcall(0xc2, 0, 0, 0); }, nullptr);
+    if (!ia32_asm_vmx_vmcall(0xc2, 0, 0, 0))
+    {
+      printf("Warning: unhook couldn't be posted to all cores\n");
+    }
+
+    Kick();
   };
 
   //
@@ -263,11 +293,195 @@ void TestIoControl()
   printf("IOCTL return value: 0x%04x (size: %u)\n", IoPort, BytesReturned);
 }
 
-int main()
+void TestSharedRing()
+{
+  HANDLE DeviceHandle;
+
+  DeviceHandle = CreateFile(TEXT("\\\\.\\hvpp"),
+                            GENERIC_READ | GENERIC_WRITE,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE,
+                            NULL,
+                            OPEN_EXISTING,
+                            0,
+                            NULL);
+
+  if (DeviceHandle == INVALID_HANDLE_VALUE)
+  {
+    printf("Error while opening 'hvpp' device!\n");
+    return;
+  }
+
+  //
+  // Map the shared ring into our address space.
+  //
+  // See hvpp/lib/shared_ring_layout.h.
+  //
+
+  ioctl_shared_ring_map_data_t MapData = {};
+  DWORD BytesReturned;
+  if (!DeviceIoControl(DeviceHandle,
+                       ioctl_shared_ring_map_t::code,
+                       &MapData,
+                       sizeof(MapData),
+                       &MapData,
+                       sizeof(MapData),
+                       &BytesReturned,
+                       NULL))
+  {
+    printf("Error while mapping shared ring!\n");
+    CloseHandle(DeviceHandle);
+    return;
+  }
+
+  auto Header = (shared_ring_header_t*)MapData.address;
+  auto Entry  = (shared_ring_entry_t*)(MapData.address + Header->entry_offset);
+  auto Data   = (uint8_t*)(MapData.address + Header->data_offset);
+
+  //
+  // Ask the hypervisor to stream 2 pages of our own memory (the
+  // function TestSharedRing itself) into the ring.
+  //
+  auto Address = (uint64_t)PAGE_ALIGN(&TestSharedRing);
+  auto BytesStreamed = ia32_asm_vmx_vmcall(0xc3, Address, 2 * PAGE_SIZE, 0);
+
+  //
+  // Consume all produced entries.
+  //
+  uint32_t ProducerIndex = Header->producer_index.load(std::memory_order_acquire);
+  uint32_t ConsumerIndex = Header->consumer_index.load(std::memory_order_relaxed);
+
+  for (; ConsumerIndex != ProducerIndex; ++ConsumerIndex)
+  {
+    uint32_t SlotIndex = ConsumerIndex & (Header->slot_count - 1);
+    auto& Item = Entry[SlotIndex];
+    auto Slot = Data + SlotIndex * Header->slot_size;
+
+    printf("Slot %4u: address: 0x%016llx, size: %u, flags: 0x%x, first byte: 0x%02x\n",
+           SlotIndex, Item.address, Item.size, Item.flags, Item.size ? Slot[0] : 0);
+  }
+
+  Header->consumer_index.store(ConsumerIndex, std::memory_order_release);
+
+  printf("Shared ring: streamed %llu bytes, dropped %u entries\n",
+         (unsigned long long)BytesStreamed, Header->dropped_count.load());
+
+  //
+  // The ring would be also unmapped on close of the handle.
+  //
+  DeviceIoControl(DeviceHandle,
+                  ioctl_shared_ring_unmap_t::code,
+                  NULL,
+                  0,
+                  NULL,
+                  0,
+                  &BytesReturned,
+                  NULL);
+
+  CloseHandle(DeviceHandle);
+}
+
+void TestTrace()
 {
+  HANDLE DeviceHandle;
+
+  DeviceHandle = CreateFile(TEXT("\\\\.\\hvpp"),
+                            GENERIC_READ | GENERIC_WRITE,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE,
+                            NULL,
+                            OPEN_EXISTING,
+                            0,
+                            NULL);
+
+  if (DeviceHandle == INVALID_HANDLE_VALUE)
+  {
+    printf("Error while opening 'hvpp' device!\n");
+    return;
+  }
+
+  //
+  // Read formatted records of the binary trace.  Nothing is returned
+  // unless the driver has been built with HVPP_ENABLE_BINARY_TRACE.
+  //
+  // See hvpp/lib/trace.h.
+  //
+
+  static CHAR Buffer[64 * 1024];
+  DWORD BytesRead;
+  while (ReadFile(DeviceHandle, Buffer, sizeof(Buffer) - 1, &BytesRead, NULL) && BytesRead > 0)
+  {
+    Buffer[BytesRead] = '\0';
+    printf("%s", Buffer);
+  }
+
+  CloseHandle(DeviceHandle);
+}
+
+void TestTraceRaw()
+{
+  HANDLE DeviceHandle;
+
+  DeviceHandle = CreateFile(TEXT("\\\\.\\hvpp"),
+                            GENERIC_READ | GENERIC_WRITE,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE,
+                            NULL,
+                            OPEN_EXISTING,
+                            0,
+                            NULL);
+
+  if (DeviceHandle == INVALID_HANDLE_VALUE)
+  {
+    printf("Error while opening 'hvpp' device!\n");
+    return;
+  }
+
+  //
+  // Read raw records of the binary trace (format IDs and raw
+  // arguments) and decode them offline - format strings are read
+  // from the driver image.
+  //
+  // See hvpp/lib/log_format.h.
+  //
+
+  static UCHAR Buffer[64 * 1024];
+  DWORD BytesReturned;
+  if (DeviceIoControl(DeviceHandle,
+                      ioctl_trace_read_raw_t::code,
+                      NULL,
+                      0,
+                      Buffer,
+                      sizeof(Buffer),
+                      &BytesReturned,
+                      NULL))
+  {
+    if (!TraceDecode("hvppdrv.sys", Buffer, BytesReturned, stdout))
+    {
+      printf("Error while decoding trace records!\n");
+    }
+  }
+
+  CloseHandle(DeviceHandle);
+}
+
+int main(int argc, char* argv[])
+{
+  //
+  // "hvppctrl.exe benchmark" runs only the user-mode benchmarks,
+  // which don't need the driver.
+  //
+  if (argc > 1 && strcmp(argv[1], "benchmark") == 0)
+  {
+    BenchmarkSpinlock(stdout);
+    BenchmarkRwSpinlock(stdout);
+    BenchmarkPerCpu(stdout);
+    return 0;
+  }
+
   TestCpuid();
   TestHook();
   TestIoControl();
+  TestSharedRing();
+  TestTrace();
+  TestTraceRaw();
 
   return 0;
 }
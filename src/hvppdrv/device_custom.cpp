@@ -14,6 +14,54 @@ void device_custom::handler(hvpp::vmexit_dbgbreak_handler& handler_instance) noe
   handler_ = &handler_instance;
 }
 
+auto device_custom::stats_handler() noexcept -> hvpp::vmexit_stats_handler&
+{
+  return *stats_handler_;
+}
+
+void device_custom::stats_handler(hvpp::vmexit_stats_handler& handler_instance) noexcept
+{
+  stats_handler_ = &handler_instance;
+}
+
+auto device_custom::ring() noexcept -> shared_ring&
+{
+  return *ring_;
+}
+
+void device_custom::ring(shared_ring& ring_instance) noexcept
+{
+  ring_ = &ring_instance;
+}
+
+error_code_t device_custom::on_cleanup() noexcept
+{
+  //
+  // The shared ring must be unmapped in the context of the process
+  // which has mapped it - before the process address space is torn
+  // down.  If the ring has been mapped by other process (or it isn't
+  // mapped at all), nothing happens.
+  //
+  if (ring_)
+  {
+    ring_->unmap_user();
+  }
+
+  return {};
+}
+
+error_code_t device_custom::on_read(void* buffer, size_t buffer_size, size_t& bytes_read) noexcept
+{
+  //
+  // Return formatted records of the binary trace (if enabled - see
+  // HVPP_ENABLE_BINARY_TRACE).  The buffer is a system buffer,
+  // therefore it can be written directly.
+  //
+  bytes_read = logger::trace::read(reinterpret_cast<char*>(buffer), buffer_size);
+
+  return {};
+}
+
 error_code_t device_custom::on_ioctl(void* buffer, size_t buffer_size, uint32_t code) noexcept
 {
   switch (code)
@@ -21,6 +69,24 @@ error_code_t device_custom::on_ioctl(void* buffer, size_t buffer_size, uint32_t
     case ioctl_enable_io_debugbreak_t::code:
       return ioctl_enable_io_debugbreak(buffer, buffer_size);
 
+    case ioctl_stats_snapshot_t::code:
+      return ioctl_stats_snapshot(buffer, buffer_size);
+
+    case ioctl_shared_ring_map_t::code:
+      return ioctl_shared_ring_map(buffer, buffer_size);
+
+    case ioctl_shared_ring_unmap_t::code:
+      return ioctl_shared_ring_unmap(buffer, buffer_size);
+
+    case ioctl_trace_read_raw_t::code:
+      return ioctl_trace_read_raw(buffer, buffer_size);
+
+    case ioctl_log_level_t::code:
+      return ioctl_log_level(buffer, buffer_size);
+
+    case ioctl_spinlock_stats_t::code:
+      return ioctl_spinlock_stats(buffer, buffer_size);
+
     default:
       hvpp_assert(0);
       return make_error_code_t(std::errc::invalid_argument);
@@ -55,8 +121,8 @@ error_code_t device_custom::ioctl_enable_io_debugbreak(void* buffer, size_t buff
     return {};
   }
 
-  handler_->storage().io_in[io_port] = true;
-  handler_->storage().io_out[io_port] = true;
+  handler_->storage().io_in.set(io_port);
+  handler_->storage().io_out.set(io_port);
 
   hvpp_info("ioctl_enable_io_debugbreak: 0x%04x", io_port);
 
@@ -67,3 +133,145 @@ error_code_t device_custom::ioctl_enable_io_debugbreak(void* buffer, size_t buff
 
   return {};
 }
+
+error_code_t device_custom::ioctl_stats_snapshot(void* buffer, size_t buffer_size)
+{
+  hvpp_assert(stats_handler_);
+  hvpp_assert(buffer);
+  hvpp_assert(buffer_size >= ioctl_stats_snapshot_t::size);
+
+  if (!buffer || buffer_size < ioctl_stats_snapshot_t::size)
+  {
+    return make_error_code_t(std::errc::invalid_argument);
+  }
+
+  //
+  // Fill the output buffer with statistics merged from all VCPUs
+  // and with their difference since the previous call.
+  // VCPUs keep running (and counting) while the snapshot is taken.
+  //
+  stats_handler_->snapshot(*((hvpp::vmexit_stats_snapshot_t*)buffer));
+
+  return {};
+}
+
+error_code_t device_custom::ioctl_shared_ring_map(void* buffer, size_t buffer_size)
+{
+  hvpp_assert(ring_);
+  hvpp_assert(buffer);
+  hvpp_assert(buffer_size >= ioctl_shared_ring_map_t::size);
+
+  if (!buffer || buffer_size < ioctl_shared_ring_map_t::size)
+  {
+    return make_error_code_t(std::errc::invalid_argument);
+  }
+
+  //
+  // Map the shared ring into the address space of the calling
+  // process and return its address and size.  See
+  // hvpp/lib/shared_ring_layout.h for description of its layout.
+  //
+  void* address;
+  size_t size;
+
+  if (auto err = ring_->map_user(address, size))
+  {
+    return err;
+  }
+
+  auto& data = *((ioctl_shared_ring_map_data_t*)buffer);
+  data.address = reinterpret_cast<uint64_t>(address);
+  data.size = size;
+
+  hvpp_info("ioctl_shared_ring_map: 0x%p (size: %u)", address, static_cast<uint32_t>(size));
+
+  return {};
+}
+
+error_code_t device_custom::ioctl_shared_ring_unmap(void* buffer, size_t buffer_size)
+{
+  (void)(buffer);
+  (void)(buffer_size);
+
+  hvpp_assert(ring_);
+
+  return ring_->unmap_user();
+}
+
+error_code_t device_custom::ioctl_trace_read_raw(void* buffer, size_t buffer_size)
+{
+  hvpp_assert(buffer);
+  hvpp_assert(buffer_size >= ioctl_trace_read_raw_t::size);
+
+  if (!buffer || buffer_size < ioctl_trace_read_raw_t::size)
+  {
+    return make_error_code_t(std::errc::invalid_argument);
+  }
+
+  //
+  // Fill the output buffer with raw records of the binary trace.
+  // The whole output buffer is returned - number of valid bytes is
+  // stored in the header, the rest of the buffer is zeroed by
+  // read_raw().  Records can be decoded offline from the driver image
+  // (see hvppctrl/lib/trace_decoder.cpp).
+  //
+  logger::trace::read_raw(buffer, buffer_size);
+
+  return {};
+}
+
+error_code_t device_custom::ioctl_log_level(void* buffer, size_t buffer_size)
+{
+  hvpp_assert(buffer);
+  hvpp_assert(buffer_size >= ioctl_log_level_t::size);
+
+  if (!buffer || buffer_size < ioctl_log_level_t::size)
+  {
+    return make_error_code_t(std::errc::invalid_argument);
+  }
+
+  auto& data = *((ioctl_log_level_data_t*)buffer);
+
+  constexpr auto all_levels = logger::level_t::trace
+                            | logger::level_t::debug
+                            | logger::level_t::info
+                            | logger::level_t::warn
+                            | logger::level_t::error;
+
+  const auto module = static_cast<logger::module_t>(data.module);
+  const auto level  = static_cast<logger::level_t>(data.level);
+
+  if (module >= logger::module_t::count || (level & ~all_levels) != logger::level_t{})
+  {
+    return make_error_code_t(std::errc::invalid_argument);
+  }
+
+  //
+  // Set runtime levels of the module and return the previous ones.
+  // Note that levels below the compile-time minimum level of the
+  // module (HVPP_LOG_LEVEL_*) can't be enabled this way.
+  //
+  data.level = static_cast<uint32_t>(logger::get_level(module));
+  logger::set_level(module, level);
+
+  return {};
+}
+
+error_code_t device_custom::ioctl_spinlock_stats(void* buffer, size_t buffer_size)
+{
+  hvpp_assert(buffer);
+  hvpp_assert(buffer_size >= ioctl_spinlock_stats_t::size);
+
+  if (!buffer || buffer_size < ioctl_spinlock_stats_t::size)
+  {
+    return make_error_code_t(std::errc::invalid_argument);
+  }
+
+  //
+  // Copy contention statistics of all instrumented spinlocks.
+  // The result is empty unless HVPP_ENABLE_SPINLOCK_STATS is defined.
+  //
+  spinlock_stats::snapshot(*((spinlock_stats::snapshot_t*)buffer));
+
+  return {};
+}
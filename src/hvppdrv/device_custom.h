@@ -1,10 +1,34 @@
 #pragma once
 #include <hvpp/lib/device.h>
+#include <hvpp/lib/log_format.h>
+#include <hvpp/lib/shared_ring.h>
+#include <hvpp/lib/spinlock_stats.h>
 #include <hvpp/vmexit/vmexit_dbgbreak.h>
+#include <hvpp/vmexit/vmexit_stats.h>
 
 #include <cstdint>
 
 using ioctl_enable_io_debugbreak_t = ioctl_read_write_t<1, sizeof(uint16_t)>;
+using ioctl_stats_snapshot_t       = ioctl_read_write_t<2, sizeof(hvpp::vmexit_stats_snapshot_t)>;
+
+struct ioctl_shared_ring_map_data_t
+{
+  uint64_t address;
+  uint64_t size;
+};
+
+using ioctl_shared_ring_map_t      = ioctl_read_write_t<3, sizeof(ioctl_shared_ring_map_data_t)>;
+using ioctl_shared_ring_unmap_t    = ioctl_none_t<4>;
+using ioctl_trace_read_raw_t       = ioctl_read_write_t<5, sizeof(logger::format::raw_header_t)>;
+
+struct ioctl_log_level_data_t
+{
+  uint32_t module;            // logger::module_t
+  uint32_t level;             // logger::level_t (mask)
+};
+
+using ioctl_log_level_t            = ioctl_read_write_t<6, sizeof(ioctl_log_level_data_t)>;
+using ioctl_spinlock_stats_t       = ioctl_read_write_t<7, sizeof(spinlock_stats::snapshot_t)>;
 
 class device_custom
   : public device
@@ -15,10 +39,26 @@ class device_custom
     auto handler() noexcept -> hvpp::vmexit_dbgbreak_handler&;
     void handler(hvpp::vmexit_dbgbreak_handler& handler_instance) noexcept;
 
+    auto stats_handler() noexcept -> hvpp::vmexit_stats_handler&;
+    void stats_handler(hvpp::vmexit_stats_handler& handler_instance) noexcept;
+
+    auto ring() noexcept -> shared_ring&;
+    void ring(shared_ring& ring_instance) noexcept;
+
+    error_code_t on_cleanup() noexcept override;
+    error_code_t on_read(void* buffer, size_t buffer_size, size_t& bytes_read) noexcept override;
     error_code_t on_ioctl(void* buffer, size_t buffer_size, uint32_t code) noexcept override;
 
   private:
     error_code_t ioctl_enable_io_debugbreak(void* buffer, size_t buffer_size);
+    error_code_t ioctl_stats_snapshot(void* buffer, size_t buffer_size);
+    error_code_t ioctl_shared_ring_map(void* buffer, size_t buffer_size);
+    error_code_t ioctl_shared_ring_unmap(void* buffer, size_t buffer_size);
+    error_code_t ioctl_trace_read_raw(void* buffer, size_t buffer_size);
+    error_code_t ioctl_log_level(void* buffer, size_t buffer_size);
+    error_code_t ioctl_spinlock_stats(void* buffer, size_t buffer_size);
 
     hvpp::vmexit_dbgbreak_handler* handler_ = nullptr;
+    hvpp::vmexit_stats_handler*    stats_handler_ = nullptr;
+    shared_ring*                   ring_ = nullptr;
 };
@@ -29,6 +29,12 @@ namespace driver
 
   vmexit_handler_t* vmexit_handler_  = nullptr;
   device_custom*    device_          = nullptr;
+  shared_ring*      ring_            = nullptr;
+
+  //
+  // Number of page-sized slots of the ring shared with user-mode.
+  //
+  static constexpr size_t ring_slot_count = 256;
 
   auto initialize() noexcept -> error_code_t
   {
@@ -52,6 +58,25 @@ namespace driver
       return err;
     }
 
+    //
+    // Create ring shared with user-mode (for streaming of the guest
+    // memory).  It's allocated before the hypervisor is started,
+    // because it's filled from VMX-root mode.
+    //
+    ring_ = new shared_ring();
+
+    if (!ring_)
+    {
+      destroy();
+      return make_error_code_t(std::errc::not_enough_memory);
+    }
+
+    if (auto err = ring_->create(ring_slot_count))
+    {
+      destroy();
+      return err;
+    }
+
     //
     // Create VM-exit handler instance.
     //
@@ -68,6 +93,19 @@ namespace driver
     //
     device_->handler(std::get<vmexit_dbgbreak_handler>(vmexit_handler_->handlers));
 
+    //
+    // Assign the vmexit_stats_handler instance to the device
+    // (for live statistics snapshots).
+    //
+    device_->stats_handler(std::get<vmexit_stats_handler>(vmexit_handler_->handlers));
+
+    //
+    // Assign the shared ring to the device (mapping into user-mode)
+    // and to the vmexit_custom_handler (producer).
+    //
+    device_->ring(*ring_);
+    std::get<vmexit_custom_handler>(vmexit_handler_->handlers).ring(*ring_);
+
     //
     // Example: Enable tracing of I/O instructions.
     //
@@ -112,6 +150,10 @@ namespace driver
       delete vmexit_handler_;
     }
 
+#ifdef HVPP_ENABLE_BINARY_TRACE
+    hvpp_info("Binary trace: %" PRIu64 " records dropped", logger::trace::dropped_count());
+#endif
+
     //
     // Destroy device.
     //
@@ -120,6 +162,15 @@ namespace driver
       delete device_;
     }
 
+    //
+    // Destroy shared ring.  All handles to the device (and therefore
+    // all user-mode mappings of the ring) are closed by now.
+    //
+    if (ring_)
+    {
+      delete ring_;
+    }
+
     hvpp_info("Hypervisor stopped");
   }
 }
@@ -1,9 +1,13 @@
 #include "vmexit_custom.h"
 
+#include <hvpp/hypervisor.h>
+
 #include <hvpp/lib/cr3_guard.h>
 #include <hvpp/lib/mp.h>
 #include <hvpp/lib/log.h>
 
+#include <algorithm>
+
 auto vmexit_custom_handler::setup(vcpu_t& vp) noexcept -> error_code_t
 {
   base_type::setup(vp);
@@ -23,6 +27,25 @@ auto vmexit_custom_handler::setup(vcpu_t& vp) noexcept -> error_code_t
   vp.ept(data->ept);
   vp.ept_enable();
 
+  //
+  // Example: Hide "hypervisor present" bit (CPUID.1:ECX[31]).
+  // CPUID results are cached per-VCPU, the override is applied
+  // only once - when the leaf is cached.
+  //
+  // vp.guest_cpuid_cache().add_override(1, cpuid_cache_t::subleaf_any,
+  //                                     cpuid_cache_t::cpuid_ecx, 1u << 31, 0);
+  //
+
+  //
+  // Example: Handle RDTSC/RDTSCP VM-exits (if "rdtsc_exiting" is enabled
+  // below) directly in vcpu.asm, without entering this handler.
+  // CPUID can't be handled this way, because this handler modifies
+  // its results.
+  //
+  // vp.fast_exit_enable(vmx::exit_reason::execute_rdtsc);
+  // vp.fast_exit_enable(vmx::exit_reason::execute_rdtscp);
+  //
+
 #if 1
   //
   // Enable exitting on 0x64 I/O port (keyboard).
@@ -172,52 +195,109 @@ void vmexit_custom_handler::handle_execute_cpuid(vcpu_t& vp) noexcept
 
 void vmexit_custom_handler::handle_execute_vmcall(vcpu_t& vp) noexcept
 {
-  auto& data = user_data(vp);
-
   switch (vp.context().rcx)
   {
     case 0xc1:
       {
-        cr3_guard _{ vp.guest_cr3() };
-
-        data.page_read = pa_t::from_va(vp.context().rdx_as_pointer);
-        data.page_exec = pa_t::from_va(vp.context().r8_as_pointer);
+        pa_t page_read;
+        pa_t page_exec;
+
+        {
+          cr3_guard _{ vp.guest_cr3() };
+
+          page_read = pa_t::from_va(vp.context().rdx_as_pointer);
+          page_exec = pa_t::from_va(vp.context().r8_as_pointer);
+        }
+
+        hvpp_trace("vmcall (hook) EXEC: 0x%p READ: 0x%p", page_exec.value(), page_read.value());
+
+        //
+        // Each VCPU has its own EPT - post the hook to all VCPUs.
+        // Other VCPUs apply it on their next VM-exit (hvppctrl forces
+        // it by executing CPUID on each core), this VCPU applies it
+        // right away.
+        //
+        // RAX is set to 1 if the request has been posted to all VCPUs.
+        //
+        const auto posted = hypervisor::request_post_all(
+          vcpu_t::request_t::call(&hook_apply, this, page_read.value(), page_exec.value()));
+        vp.request_process();
+
+        vp.context().rax = posted;
       }
+      break;
 
-      hvpp_trace("vmcall (hook) EXEC: 0x%p READ: 0x%p", data.page_exec.value(), data.page_read.value());
-
-      //
-      // Split the 2MB page where the code we want to hook resides.
-      //
-      vp.ept().split_2mb_to_4kb(data.page_exec & ept_pd_t::mask, data.page_exec & ept_pd_t::mask);
+    case 0xc2:
+      {
+        hvpp_trace("vmcall (unhook)");
 
-      //
-      // Set execute-only access on the page we want to hook.
-      //
-      vp.ept().map_4kb(data.page_exec, data.page_exec, epte_t::access_type::execute);
+        const auto posted = hypervisor::request_post_all(
+          vcpu_t::request_t::call(&hook_remove, this));
+        vp.request_process();
 
-      //
-      // We've changed EPT structure - mappings derived from EPT need to be
-      // invalidated.
-      //
-      vmx::invept_single_context(vp.ept().ept_pointer());
-    break;
+        vp.context().rax = posted;
+      }
+      break;
 
-    case 0xc2:
-      hvpp_trace("vmcall (unhook)");
-
-      //
-      // Merge the 4kb pages back to the original 2MB large page.
-      // Note that this will also automatically set the access
-      // rights to read_write_execute.
-      //
-      vp.ept().join_4kb_to_2mb(data.page_exec & ept_pd_t::mask, data.page_exec & ept_pd_t::mask);
-
-      //
-      // We've changed EPT structure - mappings derived from EPT
-      // need to be invalidated.
-      //
-      vmx::invept_single_context(vp.ept().ept_pointer());
+    case 0xc3:
+      {
+        //
+        // Stream guest memory [RDX, RDX + R8) into the shared ring
+        // (one slot per page).  Data are copied directly into the
+        // memory mapped by the client - see device_custom.
+        // Number of streamed bytes is returned in RAX.
+        //
+        // Guest memory is read via the kernel CR3, therefore callers
+        // running in user-mode (CPL > 0) are allowed to stream only
+        // pages accessible from user-mode.  Other pages are streamed
+        // as empty entries.  Note that CPL is DPL of the SS register.
+        // (ref: Vol3A[5.5(Privilege Levels)])
+        //
+        auto va = va_t{ vp.context().rdx };
+        auto size = size_t{ vp.context().r8 };
+        size_t bytes_streamed = 0;
+
+        const auto user_mode = vp.guest_ss().access.descriptor_privilege_level != 0;
+
+        hvpp_trace("vmcall (stream) VA: 0x%p SIZE: %u", va.value(), static_cast<uint32_t>(size));
+
+        while (ring_ && size > 0)
+        {
+          const auto bytes_to_copy = std::min<size_t>(size, page_size - byte_offset(va.value()));
+
+          const auto produced = ring_->produce(vp.guest_cr3().flags, va.value(), [&](void* slot, size_t, uint32_t& flags) {
+            //
+            // Pages which aren't present (or which aren't accessible
+            // by the caller) are still streamed (as empty entries),
+            // so that the client sees the gap.
+            //
+            if (user_mode && !vp.guest_memory_translator().translate(va, vp.guest_kernel_cr3()).user)
+            {
+              flags |= shared_ring_entry_t::flag_incomplete;
+              return size_t{ 0 };
+            }
+
+            if (vp.guest_read_memory(va, slot, bytes_to_copy))
+            {
+              flags |= shared_ring_entry_t::flag_incomplete;
+              return size_t{ 0 };
+            }
+
+            return bytes_to_copy;
+          });
+
+          if (!produced)
+          {
+            break;
+          }
+
+          va             += bytes_to_copy;
+          size           -= bytes_to_copy;
+          bytes_streamed += bytes_to_copy;
+        }
+
+        vp.context().rax = bytes_streamed;
+      }
       break;
 
     default:
@@ -242,7 +322,7 @@ void vmexit_custom_handler::handle_ept_violation(vcpu_t& vp) noexcept
     // the "data.page_read" we've saved before in the VMCALL
     // handler and set the access to RW.
     //
-    hvpp_trace("data_read LA: 0x%p PA: 0x%p", guest_va.value(), guest_pa.value());
+    hvpp_trace_ratelimited("data_read LA: 0x%p PA: 0x%p", guest_va.value(), guest_pa.value());
 
     vp.ept().map_4kb(data.page_exec, data.page_read, epte_t::access_type::read_write);
   }
@@ -254,7 +334,7 @@ void vmexit_custom_handler::handle_ept_violation(vcpu_t& vp) noexcept
     // the "data.page_execute" we've saved before in the VMCALL
     // handler and set the access to execute-only.
     //
-    hvpp_trace("data_execute LA: 0x%p PA: 0x%p", guest_va.value(), guest_pa.value());
+    hvpp_trace_ratelimited("data_execute LA: 0x%p PA: 0x%p", guest_va.value(), guest_pa.value());
 
     vp.ept().map_4kb(data.page_exec, data.page_exec, epte_t::access_type::execute);
   }
@@ -293,6 +373,66 @@ void vmexit_custom_handler::handle_ept_violation(vcpu_t& vp) noexcept
   vp.suppress_rip_adjust();
 }
 
+void vmexit_custom_handler::hook_apply(vcpu_t& vp, const vcpu_t::request_t& request) noexcept
+{
+  auto& handler = *reinterpret_cast<vmexit_custom_handler*>(request.context);
+  auto& data = handler.user_data(vp);
+
+  //
+  // Pages are remembered per VCPU - EPT violation handler of this
+  // VCPU switches between them.
+  //
+  data.page_read = pa_t{ request.argument[0] };
+  data.page_exec = pa_t{ request.argument[1] };
+
+  //
+  // Split the 2MB page where the code we want to hook resides.
+  //
+  vp.ept().split_2mb_to_4kb(data.page_exec & ept_pd_t::mask, data.page_exec & ept_pd_t::mask);
+
+  //
+  // Set execute-only access on the page we want to hook.
+  //
+  vp.ept().map_4kb(data.page_exec, data.page_exec, epte_t::access_type::execute);
+
+  //
+  // We've changed EPT structure - mappings derived from EPT need to be
+  // invalidated.
+  //
+  vmx::invept_single_context(vp.ept().ept_pointer());
+}
+
+void vmexit_custom_handler::hook_remove(vcpu_t& vp, const vcpu_t::request_t& request) noexcept
+{
+  auto& handler = *reinterpret_cast<vmexit_custom_handler*>(request.context);
+  auto& data = handler.user_data(vp);
+
+  //
+  // The hook might not have been applied on this VCPU (e.g. if its
+  // request queue was full).
+  //
+  if (!data.page_exec)
+  {
+    return;
+  }
+
+  //
+  // Merge the 4kb pages back to the original 2MB large page.
+  // Note that this will also automatically set the access
+  // rights to read_write_execute.
+  //
+  vp.ept().join_4kb_to_2mb(data.page_exec & ept_pd_t::mask, data.page_exec & ept_pd_t::mask);
+
+  data.page_read = pa_t{};
+  data.page_exec = pa_t{};
+
+  //
+  // We've changed EPT structure - mappings derived from EPT
+  // need to be invalidated.
+  //
+  vmx::invept_single_context(vp.ept().ept_pointer());
+}
+
 auto vmexit_custom_handler::user_data(vcpu_t& vp) noexcept -> per_vcpu_data&
 {
   return *reinterpret_cast<per_vcpu_data*>(vp.user_data());
@@ -6,6 +6,8 @@
 #include <hvpp/vmexit/vmexit_dbgbreak.h>
 #include <hvpp/vmexit/vmexit_passthrough.h>
 
+#include <hvpp/lib/shared_ring.h>
+
 using namespace ia32;
 using namespace hvpp;
 
@@ -22,6 +24,9 @@ class vmexit_custom_handler
     void handle_execute_vmcall(vcpu_t& vp) noexcept override;
     void handle_ept_violation(vcpu_t& vp) noexcept override;
 
+    void ring(shared_ring& ring_instance) noexcept
+    { ring_ = &ring_instance; }
+
   private:
     struct per_vcpu_data
     {
@@ -32,4 +37,16 @@ class vmexit_custom_handler
     };
 
     auto user_data(vcpu_t& vp) noexcept -> per_vcpu_data&;
+
+    //
+    // Cross-VCPU request callbacks - apply/remove the hook
+    // on the VCPU they're called on.
+    //
+    // Pages of the hook are passed in the request arguments
+    // (argument[0] = read page, argument[1] = execute page).
+    //
+    static void hook_apply(vcpu_t& vp, const vcpu_t::request_t& request) noexcept;
+    static void hook_remove(vcpu_t& vp, const vcpu_t::request_t& request) noexcept;
+
+    shared_ring* ring_ = nullptr;
 };